@@ -31,6 +31,18 @@ def pytest_runtest_call(item: pytest.Item) -> None:
     gc.collect()
 
 
+@pytest.fixture
+def define():
+    """Executes source in a fresh namespace (or ns) and returns the function it defines, for tests which
+    need several function objects with identical code."""
+    def _define(source, name="_f", ns=None, filename="<template>"):
+        if ns is None:
+            ns = {}
+        exec(compile(source, filename, "exec"), ns)
+        return ns[name]
+    return _define
+
+
 def pytest_addoption(parser):
     parser.addoption('--opt-level', action='store', type=int, default=1,
                      help='Optimization level')
@@ -0,0 +1,80 @@
+import pyjion
+import pytest
+
+
+@pytest.fixture
+def async_compile():
+    pyjion.config(async_compile=True)
+    yield
+    pyjion.drain()
+    pyjion.config(async_compile=False)
+
+
+def test_config():
+    assert not pyjion.config()["async_compile"]
+    pyjion.config(async_compile=True)
+    assert pyjion.config()["async_compile"]
+    pyjion.config(async_compile=False)
+    assert not pyjion.config()["async_compile"]
+
+
+def test_interpreted_until_drained(async_compile):
+    def _f(a, b):
+        return a + b
+
+    assert _f(1, 2) == 3
+    pyjion.drain()
+    info = pyjion.info(_f)
+    assert info.compiled
+    assert not info.failed
+    assert _f(1, 2) == 3
+
+
+@pytest.mark.nopgc
+def test_no_pgc(async_compile):
+    def _f(a, b):
+        return a * b
+
+    assert _f(3, 4) == 12
+    pyjion.drain()
+    assert _f(3, 4) == 12
+    info = pyjion.info(_f)
+    assert info.compiled
+    assert info.run_count >= 2
+
+
+def test_pgc_reaches_optimized(async_compile):
+    def _f(a, b):
+        c = a + b
+        return c * 2
+
+    assert _f(1, 2) == 6
+    pyjion.drain()
+    assert pyjion.info(_f).pgc == pyjion.PgcStatus.CompiledWithProbes
+    assert _f(1, 2) == 6
+    pyjion.drain()
+    assert pyjion.info(_f).pgc == pyjion.PgcStatus.Optimized
+    assert _f(1, 2) == 6
+
+
+def test_drain_empty():
+    pyjion.drain()
+
+
+def test_queued_variants_compile_in_parallel(async_compile):
+    # Enough jobs for every background thread, each code object only has one queued at a time
+    functions = []
+    for i in range(16):
+        namespace = {}
+        exec(f"def _f(a, b):\n    return a * b + {i}", namespace)
+        functions.append(namespace["_f"])
+    for i, f in enumerate(functions):
+        assert f(2, 3) == 6 + i
+    pyjion.drain()
+    for i, f in enumerate(functions):
+        assert pyjion.info(f).compiled
+        assert f(2.0, 3.0) == 6.0 + i
+    pyjion.drain()
+    for i, f in enumerate(functions):
+        assert f(2, 3) == 6 + i
+        assert f(2.0, 3.0) == 6.0 + i
@@ -0,0 +1,65 @@
+import pyjion
+import pytest
+
+
+@pytest.fixture
+def compile_budget():
+    def _set(n):
+        pyjion.config(compile_budget_ms_per_sec=n)
+    yield _set
+    pyjion.drain()
+    pyjion.config(compile_budget_ms_per_sec=0)
+
+
+SOURCE = """
+def _f(a, b):
+    return a * b + {}
+"""
+
+
+def test_config(compile_budget):
+    assert pyjion.config()["compile_budget_ms_per_sec"] == 0
+    compile_budget(50)
+    assert pyjion.config()["compile_budget_ms_per_sec"] == 50
+    with pytest.raises(ValueError):
+        pyjion.config(compile_budget_ms_per_sec=-1)
+    with pytest.raises(ValueError):
+        pyjion.config(compile_budget_ms_per_sec=1001)
+
+
+def test_compile_time_is_measured(define):
+    pyjion.config(compile_cache_size=0)
+    try:
+        before = pyjion.stats()["compile_time_us"]
+        f = define(SOURCE.format(0))
+        assert f(2, 3) == 6
+        assert pyjion.info(f).compiled
+        assert pyjion.stats()["compile_time_us"] > before
+    finally:
+        pyjion.config(compile_cache_size=256)
+
+
+def test_over_budget_compiles_are_deferred(compile_budget, define):
+    compile_budget(1)
+    functions = [define(SOURCE.format(i)) for i in range(20)]
+    deferred = pyjion.stats()["deferred_compiles"]
+    for i, f in enumerate(functions):
+        assert f(2, 3) == 6 + i
+    assert pyjion.stats()["deferred_compiles"] > deferred
+    assert not all(pyjion.info(f).compiled for f in functions)
+    pyjion.drain()
+    for i, f in enumerate(functions):
+        assert pyjion.info(f).compiled
+        assert f(2, 3) == 6 + i
+
+
+def test_unlimited_compiles_are_not_charged(compile_budget, define):
+    for i, f in enumerate(define(SOURCE.format(i)) for i in range(20)):
+        assert f(2, 3) == 6 + i
+        assert pyjion.info(f).compiled
+    compile_budget(50)
+    deferred = pyjion.stats()["deferred_compiles"]
+    f = define(SOURCE.format(20))
+    assert f(2, 3) == 6
+    assert pyjion.info(f).compiled
+    assert pyjion.stats()["deferred_compiles"] == deferred
@@ -0,0 +1,101 @@
+import pyjion
+import pytest
+
+SOURCE = """
+def _f(a, b):
+    total = 0
+    for i in range(a):
+        total += i * b
+    return total
+"""
+
+
+@pytest.fixture(autouse=True)
+def empty_cache():
+    # Entries outlive the namespaces they were compiled in, so start each test without them
+    pyjion.config(compile_cache_size=0)
+    pyjion.config(compile_cache_size=256)
+    yield
+
+
+def test_config():
+    assert pyjion.config()["compile_cache_size"] == 256
+    with pytest.raises(TypeError):
+        pyjion.config(compile_cache_size="1")
+    with pytest.raises(ValueError):
+        pyjion.config(compile_cache_size=-1)
+
+
+def test_identical_code_is_reused(define):
+    ns = {}
+    f1 = define(SOURCE, ns=ns)
+    f2 = define(SOURCE, ns=ns)
+    assert f1.__code__ is not f2.__code__
+    before = pyjion.stats()
+    assert f1(10, 2) == 90
+    assert f2(10, 2) == 90
+    after = pyjion.stats()
+    assert after["cache_hits"] == before["cache_hits"] + 1
+    assert pyjion.info(f1).compiled
+    assert pyjion.info(f2).compiled
+
+
+def test_different_constants_are_not_reused(define):
+    ns = {}
+    f1 = define(SOURCE, ns=ns)
+    f2 = define(SOURCE.replace("i * b", "i * b + 1"), ns=ns)
+    before = pyjion.stats()
+    assert f1(10, 2) == 90
+    assert f2(10, 2) == 100
+    assert pyjion.stats()["cache_hits"] == before["cache_hits"]
+
+
+def test_other_namespace_is_reused(define):
+    f1 = define(SOURCE)
+    f2 = define(SOURCE)
+    before = pyjion.stats()
+    assert f1(10, 2) == 90
+    assert f2(10, 2) == 90
+    assert pyjion.stats()["cache_hits"] == before["cache_hits"] + 1
+    assert pyjion.info(f2).compiled
+
+
+def test_other_namespace_loads_its_own_globals(define):
+    source = "def _g(a):\n    return a * SCALE\n"
+    ns1 = {"SCALE": 2}
+    ns2 = {"SCALE": 3}
+    g1 = define(source, "_g", ns=ns1)
+    g2 = define(source, "_g", ns=ns2)
+    before = pyjion.stats()
+    assert g1(5) == 10
+    assert g2(5) == 15
+    assert pyjion.stats()["cache_hits"] == before["cache_hits"] + 1
+    ns2["SCALE"] = 4
+    assert g2(5) == 20
+    assert g1(5) == 10
+
+
+def test_argument_kinds_are_part_of_the_key(define):
+    ns = {}
+    f1 = define(SOURCE, ns=ns)
+    f2 = define(SOURCE, ns=ns)
+    before = pyjion.stats()
+    assert f1(10, 2) == 90
+    assert f2(10, 2.0) == 90.0
+    assert pyjion.stats()["cache_hits"] == before["cache_hits"]
+
+
+def test_disabled(define):
+    pyjion.config(compile_cache_size=0)
+    try:
+        ns = {}
+        f1 = define(SOURCE, ns=ns)
+        f2 = define(SOURCE, ns=ns)
+        before = pyjion.stats()
+        assert f1(10, 2) == 90
+        assert f2(10, 2) == 90
+        after = pyjion.stats()
+        assert after["cache_hits"] == before["cache_hits"]
+        assert after["cache_misses"] == before["cache_misses"]
+    finally:
+        pyjion.config(compile_cache_size=256)
@@ -0,0 +1,167 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+/**
+ Test the code heap allocator. Each test uses a heap of its own, so the blocks it gets back
+ don't depend on what has been compiled already.
+*/
+#include <catch2/catch.hpp>
+#include <codeheap.h>
+#include <vector>
+
+// Blocks are rounded up to granules, or whole pages where the pages are sealed after writing.
+static size_t unitOf(CodeHeap& heap) {
+    auto block = heap.allocate(1);
+    heap.release(block);
+    return block.size;
+}
+
+TEST_CASE("Test code heap") {
+    SECTION("blocks are aligned") {
+        CodeHeap heap;
+        size_t unit = unitOf(heap);
+        for (size_t size : {1, 15, 63, 64, 65, 1000, 5000, 300000}) {
+            auto block = heap.allocate(size);
+            REQUIRE(block.rx != nullptr);
+            CHECK((uintptr_t) block.rx % CodeHeap::Granule == 0);
+            CHECK((uintptr_t) block.rw % CodeHeap::Granule == 0);
+            CHECK(block.size >= size);
+            CHECK(block.size % unit == 0);
+            CHECK(heap.seal(block));
+        }
+    }
+
+    SECTION("freed block is reused") {
+        CodeHeap heap;
+        auto block = heap.allocate(1000);
+        heap.allocate(1);// Keeps the block off the end of the chunk
+        heap.release(block);
+        CHECK(heap.statistics().free == block.size);
+        auto reused = heap.allocate(1000);
+        CHECK(reused.rx == block.rx);
+        CHECK(reused.rw == block.rw);
+        CHECK(heap.statistics().free == 0);
+    }
+
+    SECTION("end of the chunk goes back to the cursor") {
+        CodeHeap heap;
+        auto block = heap.allocate(1000);
+        heap.release(block);
+        CHECK(heap.statistics().free == 0);
+        CHECK(heap.allocate(64).rx == block.rx);
+    }
+
+    SECTION("larger block is split") {
+        CodeHeap heap;
+        size_t unit = unitOf(heap);
+        auto large = heap.allocate(10 * unit);
+        heap.allocate(1);
+        heap.release(large);
+        auto small = heap.allocate(3 * unit);
+        CHECK(small.rx == large.rx);
+        CHECK(small.size == 3 * unit);
+        CHECK(heap.statistics().free == 7 * unit);
+        // The rest is used by the next block which fits
+        CHECK(heap.allocate(7 * unit).rx == large.rx + 3 * unit);
+        CHECK(heap.statistics().free == 0);
+    }
+
+    SECTION("best fit") {
+        CodeHeap heap;
+        size_t unit = unitOf(heap);
+        auto eight = heap.allocate(8 * unit);
+        heap.allocate(1);
+        auto six = heap.allocate(6 * unit);
+        heap.allocate(1);
+        auto five = heap.allocate(5 * unit);
+        heap.allocate(1);
+        heap.release(eight);
+        heap.release(six);
+        heap.release(five);
+        // Five and six units are in the size class of four, eight is in the next one
+        CHECK(heap.allocate(4 * unit).rx == five.rx);
+        CHECK(heap.allocate(6 * unit).rx == six.rx);
+        CHECK(heap.allocate(7 * unit).rx == eight.rx);
+    }
+
+    SECTION("freed neighbours are merged") {
+        CodeHeap heap;
+        size_t unit = unitOf(heap);
+        std::vector<CodeHeap::Block> blocks;
+        for (size_t i = 0; i < 12; i++)
+            blocks.push_back(heap.allocate((1 + i % 3) * unit));
+        heap.allocate(1);
+        size_t total = 0;
+        for (size_t i = 0; i < blocks.size(); i += 2) {
+            heap.release(blocks[i]);
+            total += blocks[i].size;
+        }
+        for (size_t i = 1; i < blocks.size(); i += 2) {
+            heap.release(blocks[i]);
+            total += blocks[i].size;
+        }
+        CHECK(heap.statistics().free == total);
+        auto merged = heap.allocate(total);
+        CHECK(merged.rx == blocks[0].rx);
+        CHECK(heap.statistics().free == 0);
+    }
+
+    SECTION("churn doesn't grow the heap") {
+        CodeHeap heap;
+        size_t unit = unitOf(heap);
+        size_t reserved = 0;
+        for (size_t round = 0; round < 50; round++) {
+            std::vector<CodeHeap::Block> blocks;
+            // Up to 240 units, which fit in one chunk even when they're pages
+            for (size_t i = 0; i < 24; i++)
+                blocks.push_back(heap.allocate((1 + (i * round) % 10) * unit));
+            for (size_t i = 0; i < blocks.size(); i += 2)
+                heap.release(blocks[i]);
+            for (size_t i = 1; i < blocks.size(); i += 2)
+                heap.release(blocks[i]);
+            if (round == 0)
+                reserved = heap.statistics().reserved;
+            CHECK(heap.statistics().reserved == reserved);
+            CHECK(heap.statistics().used == 0);
+        }
+    }
+
+    SECTION("frozen chunks aren't reused") {
+        CodeHeap heap;
+        auto block = heap.allocate(1000);
+        heap.allocate(1);
+        heap.freeze();
+        heap.release(block);
+        auto next = heap.allocate(1000);
+        if (heap.statistics().dualMapped) {
+            // The memory is shared with forked children
+            CHECK(next.rx != block.rx);
+            CHECK(heap.statistics().free == 0);
+        } else {
+            // Private memory is copied on write
+            CHECK(next.rx == block.rx);
+        }
+    }
+}
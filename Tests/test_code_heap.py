@@ -0,0 +1,70 @@
+"""Test the shared code heap"""
+import pyjion
+import pytest
+
+
+def test_stats():
+    stats = pyjion.stats()
+    assert stats["code_heap_used"] + stats["code_heap_free"] <= stats["code_heap_reserved"]
+
+
+@pytest.fixture
+def no_compile_cache():
+    # Compiles shared through the compile cache don't allocate
+    pyjion.config(compile_cache_size=0)
+    yield
+    pyjion.config(compile_cache_size=256)
+
+
+def test_small_methods_share_mappings(define, no_compile_cache):
+    before = pyjion.stats()
+    functions = [define(f"def _f(x):\n    return x + {i}\n") for i in range(50)]
+
+    for i, f in enumerate(functions):
+        assert f(1) == i + 1
+        assert f(1) == i + 1
+        assert pyjion.info(f).compiled
+
+    after = pyjion.stats()
+    assert after["code_heap_used"] > before["code_heap_used"]
+    assert after["code_heap_mappings"] - before["code_heap_mappings"] < len(functions)
+
+
+def test_blocks_are_aligned():
+    # Nothing may be compiled between the allocations in these tests
+    pyjion.disable()
+    for size in (1, 63, 64, 65, 1000, 5000, 300_000):
+        block = pyjion._code_heap_allocate(size)
+        rx, rw, allocated = block
+        assert rx % 64 == 0
+        assert rw % 64 == 0
+        assert allocated >= size
+        pyjion._code_heap_release(block)
+
+
+def test_freed_block_is_reused():
+    pyjion.disable()
+    block = pyjion._code_heap_allocate(1000)
+    pyjion._code_heap_release(block)
+    reserved = pyjion.stats()["code_heap_reserved"]
+    again = pyjion._code_heap_allocate(1000)
+    assert again == block
+    assert pyjion.stats()["code_heap_reserved"] == reserved
+    pyjion._code_heap_release(again)
+
+
+def test_churn_does_not_fragment():
+    pyjion.disable()
+    unit = pyjion._code_heap_allocate(1)
+    pyjion._code_heap_release(unit)
+    unit = unit[2]
+    reserved = None
+    for n in range(50):
+        # Up to 240 units, which fit in one chunk even when they're pages
+        blocks = [pyjion._code_heap_allocate((1 + (i * n) % 10) * unit) for i in range(24)]
+        for block in blocks[::2] + blocks[1::2]:
+            pyjion._code_heap_release(block)
+        if reserved is None:
+            reserved = pyjion.stats()["code_heap_reserved"]
+    # The first round can leave the chunk being filled short of space for a later one, but only once
+    assert pyjion.stats()["code_heap_reserved"] <= reserved + 1024 * 1024
@@ -0,0 +1,119 @@
+import asyncio
+import pyjion
+
+
+def test_await():
+    async def add(a, b):
+        await asyncio.sleep(0)
+        return a + b
+
+    async def _f():
+        total = 0
+        for i in range(10):
+            total += await add(i, 1)
+        return total
+
+    assert asyncio.run(_f()) == 55
+    assert pyjion.info(_f).compiled
+
+
+def test_await_future():
+    async def _f(loop):
+        future = loop.create_future()
+        loop.call_soon(future.set_result, 42)
+        return await future
+
+    loop = asyncio.new_event_loop()
+    try:
+        assert loop.run_until_complete(_f(loop)) == 42
+    finally:
+        loop.close()
+
+
+def test_exception_from_awaited():
+    async def fail():
+        await asyncio.sleep(0)
+        raise ValueError("fail")
+
+    async def _f():
+        try:
+            await fail()
+        except ValueError as e:
+            return str(e)
+
+    assert asyncio.run(_f()) == "fail"
+
+
+def test_cancelled():
+    async def _f(started):
+        started.set()
+        await asyncio.sleep(10)
+
+    async def main():
+        started = asyncio.Event()
+        task = asyncio.create_task(_f(started))
+        await started.wait()
+        task.cancel()
+        try:
+            await task
+        except asyncio.CancelledError:
+            return "cancelled"
+
+    assert asyncio.run(main()) == "cancelled"
+
+
+def test_async_for():
+    class Counter:
+        def __init__(self, n):
+            self.i = 0
+            self.n = n
+
+        def __aiter__(self):
+            return self
+
+        async def __anext__(self):
+            if self.i == self.n:
+                raise StopAsyncIteration
+            self.i += 1
+            return self.i
+
+    async def _f():
+        total = 0
+        async for i in Counter(4):
+            total += i
+        return total
+
+    assert asyncio.run(_f()) == 10
+    assert pyjion.info(_f).compiled
+
+
+def test_async_for_error():
+    class Failing:
+        def __aiter__(self):
+            return self
+
+        async def __anext__(self):
+            raise KeyError("boom")
+
+    async def _f():
+        async for _ in Failing():
+            pass
+
+    try:
+        asyncio.run(_f())
+    except KeyError as e:
+        assert e.args == ("boom",)
+    else:
+        assert False, "KeyError not raised"
+
+
+def test_await_non_awaitable():
+    async def _f():
+        await 1
+
+    try:
+        asyncio.run(_f())
+    except TypeError as e:
+        assert "can't be used in 'await' expression" in str(e)
+    else:
+        assert False, "TypeError not raised"
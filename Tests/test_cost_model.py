@@ -0,0 +1,96 @@
+import pyjion
+import pytest
+
+
+@pytest.fixture
+def cost_model():
+    pyjion.config(cost_model=True)
+    yield
+    pyjion.config(cost_model=False)
+
+
+def test_config(cost_model):
+    assert pyjion.config()["cost_model"]
+    with pytest.raises(TypeError):
+        pyjion.config(cost_model=1)
+
+
+def test_module_body_without_loops():
+    code = compile("x = 1\ny = x + 2\n", "<module>", "exec")
+    ns = {}
+    exec(code, ns)
+    assert ns["y"] == 3
+    info = pyjion.info(code)
+    assert not info.compiled
+    assert info.compile_result == pyjion.CompilationResult.NotProfitable_RunOnce
+
+
+def test_module_body_with_loop():
+    code = compile("total = 0\nfor i in range(10):\n    total += i\n", "<module>", "exec")
+    ns = {}
+    exec(code, ns)
+    assert ns["total"] == 45
+    assert pyjion.info(code).compile_result != pyjion.CompilationResult.NotProfitable_RunOnce
+
+
+def test_call_dominated_function(cost_model):
+    def _f(a):
+        repr(a)
+        return str(a)
+
+    assert _f(1) == "1"
+    info = pyjion.info(_f)
+    assert not info.compiled
+    assert info.compile_result == pyjion.CompilationResult.NotProfitable_Calls
+
+
+def test_arithmetic_function(cost_model):
+    def _f(a, b):
+        c = a * b + a - b
+        return abs(c)
+
+    assert _f(3, 4) == 11
+    assert pyjion.info(_f).compiled
+    assert _f(3, 4) == 11
+    assert pyjion.info(_f).compiled
+
+
+class _Number:
+    def __init__(self, value):
+        self.value = value
+
+    def __mul__(self, other):
+        return _Number(self.value * other.value)
+
+    def __add__(self, other):
+        return _Number(self.value + other.value)
+
+    def __sub__(self, other):
+        return _Number(self.value - other.value)
+
+    def __abs__(self):
+        return abs(self.value)
+
+
+def test_profiled_arithmetic_on_objects(cost_model):
+    def _f(a, b):
+        c = a * b + a - b
+        return abs(c)
+
+    assert _f(_Number(3), _Number(4)) == 11
+    assert pyjion.info(_f).pgc == pyjion.PgcStatus.CompiledWithProbes
+    assert _f(_Number(3), _Number(4)) == 11
+    info = pyjion.info(_f)
+    assert not info.compiled
+    assert info.compile_result == pyjion.CompilationResult.NotProfitable_Calls
+
+
+def test_calls_in_loop(cost_model):
+    def _f(items):
+        out = []
+        for item in items:
+            out.append(str(item))
+        return out
+
+    assert _f([1, 2]) == ["1", "2"]
+    assert pyjion.info(_f).compiled
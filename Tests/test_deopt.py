@@ -0,0 +1,57 @@
+import pyjion
+
+
+def test_float_after_int_profile():
+    def _f(a, b):
+        c = a + b
+        return c * 2
+
+    for _ in range(3):
+        assert _f(1, 2) == 6
+    assert pyjion.info(_f).pgc == 2
+    assert _f(1.5, 2.5) == 8.0
+    assert _f(1, 2) == 6
+    assert not pyjion.info(_f).failed
+
+
+def test_big_int_after_small_int_profile():
+    def _f(values):
+        total = 0
+        for v in values:
+            total += v
+        return total * 2
+
+    for _ in range(3):
+        assert _f([1, 2, 3]) == 12
+    big = 2 ** 70
+    assert _f([big, 1]) == (big + 1) * 2
+    assert _f([1, 2, 3]) == 12
+
+
+def test_unboxed_local_survives_deopt():
+    def _f(a, b):
+        x = 1.5
+        y = x * 2.0
+        return (a - b) + y
+
+    for _ in range(3):
+        assert _f(5, 3) == 5.0
+    assert _f(5.5, 3) == 5.5
+    assert _f(2 ** 80, 2 ** 80) == 3.0
+
+
+def test_deoptimizations_counted():
+    def _f(values):
+        x = values[0]
+        return x * 2.0 + 1.0
+
+    # The argument is a list either way, so the same specialized variant runs and the
+    # unboxed float guard on x fails inside the compiled body.
+    for _ in range(3):
+        assert _f([1.5]) == 4.0
+    assert pyjion.info(_f).pgc == 2
+    before = pyjion.stats()["deoptimizations"]
+    assert _f([2]) == 5.0
+    assert pyjion.stats()["deoptimizations"] == before + 1
+    assert _f([1.5]) == 4.0
+    assert pyjion.stats()["deoptimizations"] == before + 1
@@ -52,7 +52,7 @@ private:
         Py_DECREF(frame);
         PyGC_Collect();
         REQUIRE(!m_jittedcode->j_failed);
-        REQUIRE(m_jittedcode->j_genericAddr != nullptr);
+        REQUIRE(m_jittedcode->j_addr != nullptr);
         return res;
     }
 
@@ -0,0 +1,154 @@
+"""Test the compilation of try/except/finally blocks"""
+import sys
+import pyjion
+import pytest
+
+
+@pytest.fixture
+def no_exception_handling():
+    pyjion.config(exception_handling=False)
+    yield
+    pyjion.config(exception_handling=True)
+
+
+def test_config():
+    assert pyjion.config()["exception_handling"]
+    with pytest.raises(TypeError):
+        pyjion.config(exception_handling=1)
+
+
+def test_try_except():
+    def _f(values):
+        total = 0
+        for v in values:
+            try:
+                total += 10 // v
+            except ZeroDivisionError:
+                total -= 1
+        return total
+
+    for _ in range(3):
+        assert _f([1, 0, 2, 0, 5]) == 15
+    assert pyjion.info(_f).compiled
+    assert sys.exc_info() == (None, None, None)
+
+
+def test_try_finally():
+    log = []
+
+    def _f(x):
+        try:
+            log.append("try")
+            return 1 / x
+        finally:
+            log.append("finally")
+
+    for _ in range(3):
+        assert _f(2) == 0.5
+    with pytest.raises(ZeroDivisionError):
+        _f(0)
+    assert log == ["try", "finally"] * 4
+    assert pyjion.info(_f).compiled
+
+
+def test_exception_propagates_through_stack():
+    def _g(x):
+        return [x, x + 1, x + "a"]
+
+    def _f(x):
+        try:
+            return (x, _g(x))
+        except TypeError as e:
+            return str(e)
+
+    for _ in range(3):
+        assert "unsupported operand" in _f(1)
+    assert sys.exc_info() == (None, None, None)
+    assert pyjion.info(_f).compiled
+
+
+def test_reraise():
+    def _f(x):
+        try:
+            return x[0]
+        except IndexError:
+            raise KeyError(x)
+
+    for _ in range(3):
+        with pytest.raises(KeyError) as e:
+            _f([])
+        assert isinstance(e.value.__context__, IndexError)
+    assert sys.exc_info() == (None, None, None)
+
+
+def test_disabled(no_exception_handling):
+    def _f():
+        try:
+            return 1
+        except ValueError:
+            return 2
+
+    for _ in range(3):
+        assert _f() == 1
+    assert not pyjion.info(_f).compiled
+    assert pyjion.info(_f).compile_result == pyjion.CompilationResult.IncompatibleOpcode_WithExcept
+
+
+def test_nested_reraise_restores_exc_info():
+    def _f():
+        try:
+            try:
+                raise KeyError("inner")
+            except KeyError:
+                raise
+        except KeyError as e:
+            return e, sys.exc_info()[1]
+
+    for _ in range(3):
+        e, handled = _f()
+        assert handled is e
+        assert sys.exc_info() == (None, None, None)
+    assert pyjion.info(_f).compiled
+
+
+def test_reraise_keeps_outer_handled_exception():
+    def _f():
+        try:
+            raise ValueError("outer")
+        except ValueError:
+            try:
+                try:
+                    raise KeyError("inner")
+                except KeyError:
+                    raise
+            except KeyError:
+                pass
+            return sys.exc_info()[0]
+
+    for _ in range(3):
+        assert _f() is ValueError
+        assert sys.exc_info() == (None, None, None)
+    assert pyjion.info(_f).compiled
+
+
+def test_reraise_to_caller():
+    def _g():
+        try:
+            raise KeyError("inner")
+        except KeyError:
+            raise
+
+    def _f():
+        try:
+            raise ValueError("outer")
+        except ValueError:
+            try:
+                _g()
+            except KeyError:
+                pass
+            return sys.exc_info()[0]
+
+    for _ in range(3):
+        assert _f() is ValueError
+        assert sys.exc_info() == (None, None, None)
+    assert pyjion.info(_g).compiled
@@ -0,0 +1,125 @@
+import ctypes
+import os
+import pyjion
+import pytest
+
+pytestmark = pytest.mark.skipif(not hasattr(os, "fork"), reason="Requires os.fork()")
+
+
+def _run_in_child(func):
+    pid = os.fork()
+    if pid == 0:
+        try:
+            code = 0 if func() else 1
+        except BaseException:
+            code = 2
+        os._exit(code)
+    _, status = os.waitpid(pid, 0)
+    return os.waitstatus_to_exitcode(status)
+
+
+def test_child_runs_parent_code():
+    def _f(a, b):
+        return a * b + a
+
+    assert _f(2, 3) == 8
+    assert _f(2, 3) == 8
+    assert pyjion.info(_f).compiled
+
+    def child():
+        compiled = pyjion.stats()["compiled"]
+        result = _f(2, 3) == 8 and _f(4, 5) == 24
+        # Nothing was compiled again
+        return result and pyjion.stats()["compiled"] == compiled
+
+    assert _run_in_child(child) == 0
+
+
+def test_background_compiler_after_fork():
+    pyjion.config(async_compile=True)
+    try:
+        def _g(a):
+            return a + 1
+
+        assert _g(1) == 2
+        pyjion.drain()
+
+        def child():
+            def _h(a):
+                return a * 2
+
+            assert _h(2) == 4
+            pyjion.drain()
+            return _h(3) == 6 and pyjion.info(_h).compiled
+
+        assert _run_in_child(child) == 0
+    finally:
+        pyjion.config(async_compile=False)
+
+
+def test_jobs_queued_at_fork_compile_in_child():
+    def _spend_budget(n):
+        total = 0
+        for i in range(n):
+            total += i
+        return total
+
+    def _k(a):
+        return a - 1
+
+    def child():
+        pyjion.config(async_compile=True, compile_budget_ms_per_sec=1)
+        # Overdraw the budget so the worker holds on to the next job
+        assert _spend_budget(10) == 45
+        pyjion.drain()
+        assert _k(1) == 0
+        if pyjion.info(_k).compiled:
+            return True
+        # What the fork hook does when the job was queued after the parent drained
+        pyjion._after_fork_child()
+        pyjion.config(async_compile=False, compile_budget_ms_per_sec=0)
+        return _k(2) == 1 and _k(3) == 2 and pyjion.info(_k).compiled
+
+    assert _run_in_child(child) == 0
+
+
+def test_parent_reuses_memory_while_child_runs():
+    def _f(a, b):
+        return a * b + a
+
+    assert _f(2, 3) == 8
+    assert pyjion.info(_f).compiled
+    pattern = b"\xcc" * 256
+    block = pyjion._code_heap_allocate(len(pattern))
+    ctypes.memmove(block[1], pattern, len(pattern))
+
+    ready, go = os.pipe()
+    pid = os.fork()
+    if pid == 0:
+        code = 2
+        try:
+            os.close(go)
+            os.read(ready, 1)
+            intact = ctypes.string_at(block[0], len(pattern)) == pattern
+            code = 0 if intact and _f(2, 3) == 8 and _f(4, 5) == 24 else 1
+        finally:
+            os._exit(code)
+    os.close(ready)
+    try:
+        # Memory the child shares can't be handed out again, or the parent would overwrite its code
+        pyjion._code_heap_release(block)
+        again = pyjion._code_heap_allocate(len(pattern))
+        ctypes.memmove(again[1], bytes(len(pattern)), len(pattern))
+
+        def _g(a):
+            return a - 1
+
+        assert _g(1) == 0
+        assert _g(2) == 1
+        assert pyjion.info(_g).compiled
+        pyjion._code_heap_release(again)
+    finally:
+        os.write(go, b"x")
+        os.close(go)
+    _, status = os.waitpid(pid, 0)
+    assert os.waitstatus_to_exitcode(status) == 0
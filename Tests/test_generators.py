@@ -193,3 +193,38 @@ def test_nested_generator_calling_uncompiled_function():
     assert list(gen) == ['!hello', '@hello', '#hello', '%hello', '$hello', '^hello']
     assert pyjion.info(cr1).failed
     assert not pyjion.info(cr2).failed
+
+
+def test_yield_from():
+    def inner():
+        yield 1
+        yield 2
+        return 3
+
+    def outer():
+        result = yield from inner()
+        yield result
+
+    assert list(outer()) == [1, 2, 3]
+    assert not pyjion.info(outer).failed
+
+
+def test_yield_from_send_and_throw():
+    def inner():
+        received = []
+        try:
+            while True:
+                received.append((yield len(received)))
+        except KeyError:
+            return received
+
+    def outer():
+        result = yield from inner()
+        yield result
+
+    gen = outer()
+    assert next(gen) == 0
+    assert gen.send("a") == 1
+    assert gen.send("b") == 2
+    assert gen.throw(KeyError) == ["a", "b"]
+    assert not pyjion.info(outer).failed
@@ -0,0 +1,90 @@
+import pyjion
+import pytest
+
+
+@pytest.fixture
+def no_specializations():
+    # Without a specialization table, every miss goes to the generic variant
+    pyjion.config(max_specializations=0)
+    yield
+    pyjion.config(max_specializations=4)
+
+
+def test_generic_not_compiled_for_matching_calls():
+    def _f(a, b):
+        return a + b
+
+    for _ in range(3):
+        assert _f(1, 2) == 3
+    info = pyjion.info(_f)
+    assert info.compiled
+    assert not info.generic_compiled
+
+
+def test_generic_compiled_on_first_miss(no_specializations):
+    def _f(a, b):
+        return a + b
+
+    for _ in range(3):
+        assert _f(1, 2) == 3
+    assert not pyjion.info(_f).generic_compiled
+    assert _f(1.5, 2.0) == 3.5
+    assert _f("a", "b") == "ab"
+    info = pyjion.info(_f)
+    assert info.generic_compiled
+    assert not info.failed
+
+
+@pytest.mark.nopgc
+def test_generic_compiled_on_first_miss_no_pgc(no_specializations):
+    def _f(a, b):
+        return a * b
+
+    assert _f(2, 3) == 6
+    assert not pyjion.info(_f).generic_compiled
+    assert _f(2.0, 3.0) == 6.0
+    assert pyjion.info(_f).generic_compiled
+
+
+def test_eager_generic():
+    pyjion.config(lazy_generic=False)
+    try:
+        def _f(a, b):
+            return a - b
+
+        assert _f(3, 2) == 1
+        assert pyjion.info(_f).generic_compiled
+    finally:
+        pyjion.config(lazy_generic=True)
+
+
+def test_stats():
+    def _f(a):
+        return a + 1
+
+    before = pyjion.stats()
+    for _ in range(3):
+        assert _f(1) == 2
+    after = pyjion.stats()
+    assert after["compiled"] > before["compiled"]
+    assert after["generic_skipped"] == after["compiled"] - after["generic_compiled"]
+
+
+def test_eager_generic_variants_both_run(no_specializations):
+    pyjion.config(lazy_generic=False)
+    try:
+        def _f(a, b):
+            total = 0
+            for i in range(4):
+                total += a * i - b
+            return total
+
+        assert _f(2, 1) == 8
+        info = pyjion.info(_f)
+        assert info.compiled
+        assert info.generic_compiled
+        assert _f(2, 1) == 8
+        assert _f(2.0, 0.5) == 10.0
+        assert _f(2, 1) == 8
+    finally:
+        pyjion.config(lazy_generic=True)
@@ -0,0 +1,139 @@
+import sys
+import pyjion
+import pytest
+
+
+@pytest.fixture
+def threshold():
+    def _set(n, loop_weight=100):
+        pyjion.config(threshold=n, loop_weight=loop_weight)
+    yield _set
+    pyjion.config(threshold=0, loop_weight=100)
+
+
+def test_config(threshold):
+    assert pyjion.config()["threshold"] == 0
+    assert pyjion.config()["loop_weight"] == 100
+    threshold(1000, 10)
+    assert pyjion.config()["threshold"] == 1000
+    assert pyjion.config()["loop_weight"] == 10
+    with pytest.raises(ValueError):
+        pyjion.config(threshold=-1)
+    with pytest.raises(ValueError):
+        pyjion.config(loop_weight=-1)
+
+
+def test_looping_function_gets_hot(threshold):
+    threshold(1000)
+
+    def _f(n):
+        total = 0
+        for i in range(n):
+            total += i % 7
+        return total
+
+    # Only the back edges taken count, a loop which doesn't run adds nothing
+    assert _f(0) == 0
+    assert pyjion.info(_f).hotness == 1
+    assert _f(5) == 10
+    assert pyjion.info(_f).hotness == 502
+    # Counting stops once the function is hot
+    assert _f(10) == 24
+    info = pyjion.info(_f)
+    assert info.hotness == 1003
+    assert not info.compiled
+    assert _f(10) == 24
+    assert pyjion.info(_f).compiled
+
+
+def test_long_loop_gets_hot_in_one_call(threshold):
+    threshold(10_000)
+
+    def _f(n):
+        total = 0
+        for i in range(n):
+            total += i
+        return total
+
+    assert _f(1_000_000) == 499999500000
+    info = pyjion.info(_f)
+    assert info.hotness == 10_001
+    assert not info.compiled
+    assert _f(10) == 45
+    assert pyjion.info(_f).compiled
+
+
+def test_each_loop_counts(threshold):
+    threshold(1000, 10)
+
+    def _f(n):
+        total = 0
+        for i in range(n):
+            total += i
+        while n > 0:
+            n -= 1
+            total += n
+        return total
+
+    # Three iterations of the for loop, the while loop tests at the bottom so it jumps back twice
+    assert _f(3) == 6
+    assert pyjion.info(_f).hotness == 51
+
+
+def test_counting_is_hidden(threshold):
+    def _callee(a):
+        return a + 1
+
+    assert _callee(1) == 2
+    assert pyjion.info(_callee).compiled
+    threshold(1000)
+
+    def _f(n):
+        seen = []
+        for i in range(n):
+            seen.append((sys.gettrace(), _callee(i)))
+        return seen
+
+    before = pyjion.stats()["hooks_compiled"]
+    assert _f(3) == [(None, 1), (None, 2), (None, 3)]
+    # The callee ran its compiled code rather than a variant with tracing hooks
+    assert pyjion.stats()["hooks_compiled"] == before
+    assert pyjion.info(_f).hotness == 301
+    assert sys.gettrace() is None
+
+
+def test_trace_function_set_while_counting(threshold):
+    threshold(1000)
+    events = []
+
+    def _tracer(frame, event, arg):
+        events.append((frame.f_code.co_name, event))
+
+    def _callee():
+        return 1
+
+    def _f(n):
+        for i in range(n):
+            if i == 1:
+                sys.settrace(_tracer)
+        _callee()
+        sys.settrace(None)
+
+    _f(3)
+    assert ("_callee", "call") in events
+    assert sys.gettrace() is None
+
+
+def test_calls_count_towards_hotness(threshold):
+    threshold(1000, 0)
+
+    def _f(a):
+        return a + 1
+
+    for i in range(1000):
+        assert _f(i) == i + 1
+    info = pyjion.info(_f)
+    assert info.hotness == 1000
+    assert not info.compiled
+    assert _f(1) == 2
+    assert pyjion.info(_f).compiled
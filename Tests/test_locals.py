@@ -1,4 +1,5 @@
 """Test the optimization of frame locals"""
+import pyjion
 
 
 def test_simple_compare():
@@ -19,3 +20,49 @@ def test_simple_delete():
         return False
 
     assert not test_f()
+
+
+def test_locals_sees_unboxed_values():
+    def test_f(n):
+        total = 0
+        seen = []
+        for i in range(n):
+            total += i * 2
+            seen.append(locals()["total"])
+        return seen
+
+    assert test_f(5) == [0, 2, 6, 12, 20]
+    assert pyjion.info(test_f).compiled
+
+
+def test_eval_reads_locals():
+    def test_f(n):
+        x = 0.5
+        for _ in range(n):
+            x = x * 2.0
+        return eval("x + 1")
+
+    assert test_f(3) == 5.0
+    assert pyjion.info(test_f).compiled
+
+
+def test_dir_and_vars_before_assignment():
+    def test_f():
+        names = dir()
+        a = 1
+        for _ in range(3):
+            a = a + 1
+        return names, sorted(vars())
+
+    assert test_f() == ([], ["_", "a", "names"])
+
+
+def test_shadowed_locals():
+    ns = {"locals": lambda: "shadowed"}
+    exec("def test_f(n):\n"
+         "    total = 0\n"
+         "    for i in range(n):\n"
+         "        total += i\n"
+         "    return locals(), total\n", ns)
+
+    assert ns["test_f"](4) == ("shadowed", 6)
@@ -0,0 +1,89 @@
+import pyjion
+import pytest
+
+
+@pytest.fixture
+def osr():
+    pyjion.config(osr_threshold=100)
+    yield
+    pyjion.config(osr_threshold=1000)
+
+
+def test_config():
+    assert pyjion.config()["osr_threshold"] == 1000
+    with pytest.raises(ValueError):
+        pyjion.config(osr_threshold=-1)
+
+
+def test_range_loop(osr):
+    def _f(n):
+        total = 0
+        for i in range(n):
+            total += i
+        return total
+
+    before = pyjion.stats()["osr_entries"]
+    assert _f(10_000) == 49995000
+    assert pyjion.stats()["osr_entries"] == before + 1
+    assert pyjion.info(_f).pgc == 2
+    assert _f(100) == 4950
+
+
+def test_while_loop(osr):
+    def _f(n):
+        i = 0
+        x = 0.5
+        while i < n:
+            x = x * 1.0001
+            i += 1
+        return i, x
+
+    i, x = _f(5_000)
+    assert i == 5_000
+    assert x == pytest.approx(0.5 * 1.0001 ** 5_000)
+
+
+def test_nested_loops(osr):
+    def _f(rows):
+        out = []
+        for row in rows:
+            s = 0
+            for v in row:
+                s += v
+            out.append(s)
+        return out
+
+    rows = [list(range(50)) for _ in range(50)]
+    assert _f(rows) == [1225] * 50
+
+
+def test_reassigned_argument_not_replaced(osr):
+    def _f(n):
+        total = 0
+        while n > 0:
+            total += n
+            n -= 1
+        return total
+
+    before = pyjion.stats()["osr_entries"]
+    assert _f(1_000) == 500500
+    assert pyjion.stats()["osr_entries"] == before
+
+
+def test_async_compile(osr):
+    def _f(n):
+        total = 0
+        for i in range(n):
+            total += i
+        return total
+
+    pyjion.precompile(_f)
+    pyjion.config(async_compile=True)
+    try:
+        # The optimized code is queued from inside the loop, the frame keeps running the probed code
+        assert _f(100_000) == 4999950000
+        pyjion.drain()
+        assert pyjion.info(_f).pgc == pyjion.PgcStatus.Optimized
+        assert _f(100) == 4950
+    finally:
+        pyjion.config(async_compile=False)
@@ -0,0 +1,114 @@
+import types
+import pyjion
+import pytest
+
+
+def test_nojit():
+    @pyjion.nojit
+    def _f(a):
+        return a + 1
+
+    assert _f(1) == 2
+    info = pyjion.info(_f)
+    assert not info.compiled
+    assert info.compile_result == pyjion.CompilationResult.Excluded
+
+
+def test_jit_level():
+    @pyjion.jit(level=2)
+    def _f(a, b):
+        return a * b
+
+    assert _f(3, 4) == 12
+    assert _f(3, 4) == 12
+    assert pyjion.info(_f).compiled
+
+
+def test_jit_level_zero():
+    @pyjion.jit(level=0)
+    def _f(a, b):
+        return a * b
+
+    assert _f(3, 4) == 12
+    info = pyjion.info(_f)
+    assert info.compiled
+    assert info.optimizations == 0
+
+
+def test_jit_without_pgc():
+    @pyjion.jit(pgc=False)
+    def _f(a, b):
+        return a + b
+
+    assert _f(1, 2) == 3
+    info = pyjion.info(_f)
+    assert info.compiled
+    # Compiled once, without a probed variant first
+    assert info.pgc != pyjion.PgcStatus.Uncompiled
+    assert pyjion.config()["pgc"]
+
+
+def test_jit_threshold():
+    @pyjion.jit(threshold=10)
+    def _f(a):
+        return a + 1
+
+    assert _f(1) == 2
+    assert not pyjion.info(_f).compiled
+
+
+def test_jit_without_arguments():
+    @pyjion.jit
+    def _f(a):
+        return a + 1
+
+    assert _f(1) == 2
+    assert pyjion.info(_f).compiled
+
+
+def test_invalid_level():
+    def _f():
+        pass
+
+    with pytest.raises(ValueError):
+        pyjion.jit(level=3)(_f)
+
+
+def test_module_patterns():
+    pyjion.config(exclude_modules=["_excluded*"])
+    try:
+        assert pyjion.config()["exclude_modules"] == ["_excluded*"]
+        excluded = types.ModuleType("_excluded_module")
+        exec("def f(a):\n    return a + 1\n", excluded.__dict__)
+        assert excluded.f(1) == 2
+        assert pyjion.info(excluded.f).compile_result == pyjion.CompilationResult.Excluded
+
+        # A decorator wins over the patterns
+        exec("import pyjion\n@pyjion.jit\ndef g(a):\n    return a + 1\n", excluded.__dict__)
+        assert excluded.g(1) == 2
+        assert pyjion.info(excluded.g).compiled
+    finally:
+        pyjion.config(exclude_modules=[])
+
+
+def test_include_patterns():
+    pyjion.config(include_modules=["_included"])
+    try:
+        included = types.ModuleType("_included")
+        other = types.ModuleType("_other")
+        source = "def f(a):\n    return a + 1\n"
+        exec(source, included.__dict__)
+        exec(source, other.__dict__)
+        assert included.f(1) == 2
+        assert other.f(1) == 2
+        assert pyjion.info(included.f).compiled
+        assert pyjion.info(other.f).compile_result == pyjion.CompilationResult.Excluded
+    finally:
+        pyjion.config(include_modules=[])
+
+
+def test_invalid_patterns():
+    with pytest.raises(TypeError):
+        pyjion.config(include_modules="abc")
+    with pytest.raises(TypeError):
+        pyjion.config(exclude_modules=[1])
@@ -0,0 +1,121 @@
+import types
+import pyjion
+import pytest
+
+
+def test_function():
+    def _f(a, b):
+        return a * b + 1
+
+    assert pyjion.precompile(_f) == 1
+    info = pyjion.info(_f)
+    assert info.compiled
+    assert info.run_count == 0
+    assert _f(2, 3) == 7
+    assert _f(2.0, 3) == 7.0
+
+
+def test_function_with_kinds():
+    def _f(a, b):
+        return a * b + 1
+
+    assert pyjion.precompile(_f, arg_kinds=(int, float)) == 1
+    assert pyjion.info(_f).compiled
+    assert _f(2, 3.0) == 7.0
+    # Other argument types still work
+    assert _f(2, 3) == 7
+
+
+def test_wrong_number_of_kinds():
+    def _f(a, b):
+        return a + b
+
+    with pytest.raises(ValueError):
+        pyjion.precompile(_f, arg_kinds=(int,))
+
+
+def test_kinds_only_for_functions():
+    class _C:
+        pass
+
+    with pytest.raises(TypeError):
+        pyjion.precompile(_C, arg_kinds=(int,))
+
+
+def test_probed_variant_runs_first():
+    def _f(a, b):
+        return a + b
+
+    pyjion.precompile(_f)
+    assert pyjion.info(_f).pgc == pyjion.PgcStatus.CompiledWithProbes
+    assert _f(1, 2) == 3
+    assert _f(1, 2) == 3
+    assert pyjion.info(_f).pgc == pyjion.PgcStatus.Optimized
+
+
+def test_bound_method():
+    class _C:
+        def add(self, a):
+            return a + 1
+
+    c = _C()
+    assert pyjion.precompile(c.add, arg_kinds=(int,)) == 1
+    assert pyjion.info(_C.add).compiled
+    assert c.add(1) == 2
+
+
+def test_class():
+    class _C:
+        def a(self):
+            return 1
+
+        @staticmethod
+        def b():
+            return 2
+
+        @property
+        def c(self):
+            return 3
+
+    assert pyjion.precompile(_C) == 3
+    assert pyjion.info(_C.a).compiled
+    assert pyjion.info(_C.b).compiled
+    assert _C().a() + _C.b() + _C().c == 6
+
+
+def test_module():
+    module = types.ModuleType("_precompiled")
+    exec("import os\ndef f(x):\n    return x + 1\nclass C:\n    def g(self):\n        return 2\n", module.__dict__)
+    assert pyjion.precompile(module) == 2
+    assert pyjion.info(module.f).compiled
+    assert module.f(1) == 2
+
+
+def test_kinds_must_be_builtin():
+    created = []
+
+    class _Kind:
+        def __init__(self):
+            created.append(self)
+
+    def _f(a):
+        return a
+
+    with pytest.raises(TypeError):
+        pyjion.precompile(_f, arg_kinds=(_Kind,))
+    assert not created
+    assert pyjion.precompile(_f, arg_kinds=(_Kind(),)) == 1
+
+
+def test_excluded_module():
+    pyjion.config(exclude_modules=["_precompile_excluded"])
+    try:
+        module = types.ModuleType("_precompile_excluded")
+        exec("def f(x):\n    return x + 1\n", module.__dict__)
+        assert pyjion.precompile(module) == 0
+        info = pyjion.info(module.f)
+        assert not info.compiled
+        assert info.compile_result == pyjion.CompilationResult.Excluded
+        assert module.f(1) == 2
+    finally:
+        pyjion.config(exclude_modules=[])
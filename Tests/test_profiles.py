@@ -0,0 +1,137 @@
+import json
+import sys
+import types
+import pyjion
+import pytest
+
+SOURCE = """
+def _f(a, b):
+    total = 0
+    for i in range(a):
+        total += i * b
+    return total
+"""
+
+
+@pytest.fixture(autouse=True)
+def clear_profiles():
+    pyjion.clear_profiles()
+    yield
+    pyjion.clear_profiles()
+
+
+def _saved(path):
+    with open(path) as f:
+        return json.load(f)
+
+
+def _save_with_types(tmp_path, define, replace):
+    f = define(SOURCE, filename="<profiles>")
+    assert f(10, 2) == 90
+    assert f(10, 2) == 90
+    path = tmp_path / "profiles.json"
+    pyjion.save_profiles(path)
+    saved = _saved(path)
+    for entries in saved["profiles"].values():
+        for entry in entries:
+            replace(entry)
+    pyjion.clear_profiles()
+    path.write_text(json.dumps(saved))
+    return path
+
+
+def test_save_and_reload(tmp_path, define):
+    f1 = define(SOURCE, filename="<profiles>")
+    assert f1(10, 2) == 90
+    assert f1(10, 2) == 90
+    assert pyjion.info(f1).pgc == pyjion.PgcStatus.Optimized
+
+    path = tmp_path / "profiles.json"
+    pyjion.save_profiles(path)
+    saved = _saved(path)
+    assert saved["profiles"]
+    assert any(entry[2] == "builtins:int" for entries in saved["profiles"].values() for entry in entries)
+
+    assert pyjion.load_profiles(path)
+    before = pyjion.stats()["profiles_loaded"]
+    f2 = define(SOURCE, filename="<profiles>")
+    assert f2(10, 2) == 90
+    assert pyjion.stats()["profiles_loaded"] == before + 1
+    # The first compile used the loaded profile, so there's no probed variant
+    assert pyjion.info(f2).pgc == pyjion.PgcStatus.Optimized
+    assert f2(10, 2) == 90
+
+
+def test_merge_conflicts(tmp_path, define):
+    f = define(SOURCE, filename="<profiles>")
+    assert f(10, 2) == 90
+    assert f(10, 2) == 90
+    path = tmp_path / "profiles.json"
+    pyjion.save_profiles(path)
+    saved = _saved(path)
+    for entries in saved["profiles"].values():
+        for entry in entries:
+            if entry[2] == "builtins:int":
+                entry[2] = "builtins:float"
+    other = tmp_path / "other.json"
+    other.write_text(json.dumps(saved))
+
+    assert pyjion.load_profiles(other)
+    pyjion.save_profiles(path)
+    merged = _saved(path)
+    assert any(entry[2] == "" for entries in merged["profiles"].values() for entry in entries)
+
+
+def test_version_mismatch(tmp_path):
+    path = tmp_path / "profiles.json"
+    path.write_text(json.dumps({"version": "0.0.0", "profiles": {}}))
+    assert not pyjion.load_profiles(path)
+
+
+def test_clear(tmp_path, define):
+    f = define(SOURCE, filename="<profiles>")
+    assert f(10, 2) == 90
+    assert f(10, 2) == 90
+    assert pyjion._profiles()
+    pyjion.clear_profiles()
+    assert not pyjion._profiles()
+
+
+def test_kind_out_of_range(tmp_path, define):
+    def _replace(entry):
+        entry[3] = 1000
+
+    path = _save_with_types(tmp_path, define, _replace)
+    with pytest.raises(ValueError):
+        pyjion.load_profiles(path)
+
+
+def test_types_resolved_without_getattr(tmp_path, define):
+    looked_up = []
+    module = types.ModuleType("_profiled_types")
+    module.__getattr__ = looked_up.append
+    sys.modules[module.__name__] = module
+    try:
+        def _replace(entry):
+            entry[2] = "_profiled_types:Missing"
+
+        path = _save_with_types(tmp_path, define, _replace)
+        assert pyjion.load_profiles(path)
+        before = pyjion.stats()["profiles_loaded"]
+        f = define(SOURCE, filename="<profiles>")
+        assert f(10, 2) == 90
+        assert not looked_up
+        assert pyjion.stats()["profiles_loaded"] == before
+        assert pyjion.info(f).pgc == pyjion.PgcStatus.CompiledWithProbes
+    finally:
+        del sys.modules[module.__name__]
+
+
+def test_policy_without_pgc(tmp_path, define):
+    path = _save_with_types(tmp_path, define, lambda entry: None)
+    assert pyjion.load_profiles(path)
+    before = pyjion.stats()["profiles_loaded"]
+    f = pyjion.jit(define(SOURCE, filename="<profiles>"), pgc=False)
+    assert f(10, 2) == 90
+    assert pyjion.info(f).compiled
+    assert pyjion.stats()["profiles_loaded"] == before
@@ -0,0 +1,68 @@
+import pyjion
+import pytest
+
+
+def _big_function(head, tail_statements=2_500, end=()):
+    """Build a function with more bytecode than the code object size limit."""
+    lines = ["def _f(n):"] + ["    " + line for line in head]
+    lines += ["    x = x + 1"] * tail_statements
+    lines += ["    " + line for line in end]
+    lines += ["    return total, x"]
+    namespace = {}
+    exec("\n".join(lines), namespace)
+    return namespace["_f"]
+
+
+def test_loop_region():
+    _f = _big_function([
+        "total = 0",
+        "for i in range(n):",
+        "    total += i",
+        "x = 0",
+    ])
+    assert len(_f.__code__.co_code) > 10_000
+
+    before = pyjion.stats()["region_exits"]
+    assert _f(1_000) == (499500, 2_500)
+    assert _f(10) == (45, 2_500)
+    assert pyjion.info(_f).compiled
+    assert pyjion.stats()["region_exits"] > before
+
+
+def test_exception_in_interpreted_tail():
+    _f = _big_function([
+        "total = 0",
+        "while n > 0:",
+        "    total += n",
+        "    n -= 1",
+        "x = 0",
+    ], end=["x = total // n"])
+    before = pyjion.stats()["region_exits"]
+    for _ in range(3):
+        with pytest.raises(ZeroDivisionError):
+            _f(10)
+    assert pyjion.info(_f).compiled
+    # The loop ran in the region, the exception was raised by the interpreter after it
+    assert pyjion.stats()["region_exits"] > before
+
+
+def test_no_loop_not_compiled():
+    _f = _big_function(["total = n", "x = 0"])
+    assert _f(1) == (1, 2_500)
+    assert not pyjion.info(_f).compiled
+
+
+def test_try_around_function_not_compiled():
+    _f = _big_function([
+        "total = 0",
+        "try:",
+        "    for i in range(n):",
+        "        total += i",
+        "    x = 0",
+    ] + ["    x = x + 1"] * 2_500 + [
+        "except ValueError:",
+        "    x = -1",
+        "x = x - 2_500",
+    ], tail_statements=0)
+    assert _f(10) == (45, 0)
+    assert not pyjion.info(_f).compiled
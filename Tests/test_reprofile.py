@@ -0,0 +1,65 @@
+import pyjion
+import pytest
+
+
+@pytest.fixture
+def reprofile_threshold():
+    def _set(n, max_reprofiles=3):
+        pyjion.config(reprofile_threshold=n, max_reprofiles=max_reprofiles)
+    yield _set
+    pyjion.config(reprofile_threshold=100, max_reprofiles=3)
+
+
+def test_config(reprofile_threshold):
+    assert pyjion.config()["reprofile_threshold"] == 100
+    assert pyjion.config()["max_reprofiles"] == 3
+    reprofile_threshold(5, 1)
+    assert pyjion.config()["reprofile_threshold"] == 5
+    assert pyjion.config()["max_reprofiles"] == 1
+    with pytest.raises(ValueError):
+        pyjion.config(reprofile_threshold=-1)
+    with pytest.raises(ValueError):
+        pyjion.config(max_reprofiles=256)
+
+
+def test_changed_workload(reprofile_threshold):
+    reprofile_threshold(2)
+
+    def _f(values):
+        x = values[0]
+        return x * 2.0 + 1.0
+
+    for _ in range(3):
+        assert _f([1.5]) == 4.0
+    assert pyjion.info(_f).pgc == 2
+    before = pyjion.stats()["reprofiles"]
+    # Each call fails the float guard on x and records a guard failure
+    assert _f([2]) == 5.0
+    assert _f([2]) == 5.0
+    assert pyjion.info(_f).reprofiles == 0
+    # The next call sees the threshold has been reached
+    assert _f([2]) == 5.0
+    info = pyjion.info(_f)
+    assert not info.failed
+    assert info.reprofiles == 1
+    assert pyjion.stats()["reprofiles"] == before + 1
+
+
+def test_backoff(reprofile_threshold):
+    reprofile_threshold(1, max_reprofiles=1)
+
+    def _f(values):
+        x = values[0]
+        return x * 2.0 + 1.0
+
+    for _ in range(3):
+        assert _f([1.5]) == 4.0
+    assert _f([2]) == 5.0
+    assert _f([2]) == 5.0
+    assert pyjion.info(_f).reprofiles == 1
+    for i in range(20):
+        if i % 2:
+            assert _f([1.5]) == 4.0
+        else:
+            assert _f([2]) == 5.0
+    assert pyjion.info(_f).reprofiles == 1
@@ -0,0 +1,63 @@
+import pyjion
+import pytest
+
+
+@pytest.fixture
+def max_specializations():
+    def _set(n):
+        pyjion.config(max_specializations=n)
+    yield _set
+    pyjion.config(max_specializations=4)
+
+
+def test_config(max_specializations):
+    assert pyjion.config()["max_specializations"] == 4
+    max_specializations(8)
+    assert pyjion.config()["max_specializations"] == 8
+    with pytest.raises(ValueError):
+        pyjion.config(max_specializations=256)
+
+
+def test_second_signature_gets_specialized():
+    def _f(a, b):
+        return a + b
+
+    for _ in range(3):
+        assert _f(1, 2) == 3
+    assert _f(1.5, 2.5) == 4.0
+    assert _f(2.5, 2.5) == 5.0
+    info = pyjion.info(_f)
+    assert info.specializations == 1
+    assert not info.generic_compiled
+
+
+def test_lru_replacement(max_specializations):
+    max_specializations(2)
+
+    def _f(a, b):
+        return a + b
+
+    for _ in range(3):
+        assert _f(1, 2) == 3
+    assert _f(1.5, 2.5) == 4.0
+    assert _f("a", "b") == "ab"
+    assert _f([1], [2]) == [1, 2]
+    assert _f((1,), (2,)) == (1, 2)
+    info = pyjion.info(_f)
+    assert info.specializations == 2
+    assert not info.failed
+
+
+def test_megamorphic_falls_back_to_generic(max_specializations):
+    max_specializations(1)
+
+    def _f(a, b):
+        return a + b
+
+    for _ in range(3):
+        assert _f(1, 2) == 3
+    for args, expected in (((1.5, 2.5), 4.0), (("a", "b"), "ab"), (([1], [2]), [1, 2]), (((1,), (2,)), (1, 2))):
+        assert _f(*args) == expected
+    info = pyjion.info(_f)
+    assert info.specializations == 1
+    assert info.generic_compiled
@@ -0,0 +1,35 @@
+import threading
+import pyjion
+
+
+SOURCE = """
+def _f(a, b):
+    total = 0
+    for x in range(a):
+        total += x * b + {}
+    return total
+"""
+
+
+def test_compiles_from_several_threads(define):
+    functions = [define(SOURCE.format(i)) for i in range(16)]
+    errors = []
+
+    def _run(offset):
+        try:
+            for j in range(len(functions)):
+                i = (j + offset) % len(functions)
+                assert functions[i](10, 2) == 90 + 10 * i
+        except Exception as e:
+            errors.append(e)
+
+    threads = [threading.Thread(target=_run, args=(n,)) for n in range(4)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    assert not errors
+    for i, f in enumerate(functions):
+        assert pyjion.info(f).compiled
+        assert f(10, 2) == 90 + 10 * i
+
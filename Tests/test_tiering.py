@@ -0,0 +1,56 @@
+import pyjion
+import pytest
+
+
+@pytest.fixture
+def tier_up_threshold():
+    def _set(n):
+        pyjion.config(tier_up_threshold=n)
+    yield _set
+    pyjion.config(tier_up_threshold=0)
+
+
+def test_config(tier_up_threshold):
+    assert pyjion.config()["tier_up_threshold"] == 0
+    tier_up_threshold(10)
+    assert pyjion.config()["tier_up_threshold"] == 10
+    with pytest.raises(ValueError):
+        pyjion.config(tier_up_threshold=-1)
+
+
+def test_probed_variant_is_baseline(tier_up_threshold):
+    tier_up_threshold(3)
+
+    def _f(a, b):
+        return a * b + 1
+
+    assert _f(2, 3) == 7
+    info = pyjion.info(_f)
+    assert info.compiled
+    assert info.baseline
+    assert info.pgc == pyjion.PgcStatus.CompiledWithProbes
+    for _ in range(3):
+        assert _f(2, 3) == 7
+    assert pyjion.info(_f).pgc == pyjion.PgcStatus.CompiledWithProbes
+    tier_ups = pyjion.stats()["tier_ups"]
+    assert _f(2, 3) == 7
+    info = pyjion.info(_f)
+    assert not info.baseline
+    assert info.pgc == pyjion.PgcStatus.Optimized
+    assert pyjion.stats()["tier_ups"] == tier_ups + 1
+
+
+@pytest.mark.nopgc
+def test_baseline_without_pgc(tier_up_threshold):
+    tier_up_threshold(2)
+
+    def _f(a):
+        return [i * a for i in range(10)]
+
+    assert _f(2)[-1] == 18
+    assert pyjion.info(_f).baseline
+    for _ in range(3):
+        assert _f(2)[-1] == 18
+    info = pyjion.info(_f)
+    assert info.compiled
+    assert not info.baseline
@@ -125,3 +125,87 @@ def test_custom_tracer(capsys):
     captured = capsys.readouterr()
     assert "Calling <code object _f" in captured.out
     assert "Returning " in captured.out
+
+
+def test_profiler_attached_after_compile(capsys):
+    def _f():
+        a = 1
+        b = 2
+        return a + b
+
+    def profile(frame, event, args):
+        if frame.f_code is _f.__code__:
+            print(f"{event} {args}")
+
+    assert _f() == 3
+    assert pyjion.info(_f).compiled
+    assert not pyjion.info(_f).profiling
+    before = pyjion.stats()["hooks_compiled"]
+
+    sys.setprofile(profile)
+    assert _f() == 3
+    sys.setprofile(None)
+    captured = capsys.readouterr()
+    assert "call None" in captured.out
+    assert "return 3" in captured.out
+    assert pyjion.info(_f).profiling
+    assert pyjion.stats()["hooks_compiled"] == before + 1
+
+    # Once the profiler is gone the function runs its variant without hooks again
+    assert _f() == 3
+    pyjion.dis.dis(_f)
+    captured = capsys.readouterr()
+    assert "call None" not in captured.out
+    assert "METHOD_PROFILE_FRAME_ENTRY" not in captured.out
+
+
+def test_hooks_variant_queued(capsys):
+    def _f():
+        a = 1
+        b = 2
+        return a + b
+
+    def profile(frame, event, args):
+        if frame.f_code is _f.__code__:
+            print(f"{event} {args}")
+
+    assert _f() == 3
+    assert pyjion.info(_f).compiled
+    before = pyjion.stats()["hooks_compiled"]
+    pyjion.config(async_compile=True)
+    try:
+        # The hooks variant is queued, the interpreter calls the profiler until it's compiled
+        sys.setprofile(profile)
+        assert _f() == 3
+        sys.setprofile(None)
+        assert "return 3" in capsys.readouterr().out
+        assert not pyjion.info(_f).profiling
+        pyjion.drain()
+        assert pyjion.info(_f).profiling
+        assert pyjion.stats()["hooks_compiled"] == before + 1
+
+        sys.setprofile(profile)
+        assert _f() == 3
+        sys.setprofile(None)
+        assert "return 3" in capsys.readouterr().out
+    finally:
+        pyjion.config(async_compile=False)
+
+
+def test_compiled_while_tracing(capsys):
+    def custom_trace(frame, event, args):
+        return custom_trace
+
+    def _f():
+        a = 1
+        b = 2
+        return a + b
+
+    sys.settrace(custom_trace)
+    assert _f() == 3
+    sys.settrace(None)
+    assert _f() == 3
+    pyjion.dis.dis(_f)
+    captured = capsys.readouterr()
+    assert "METHOD_TRACE_LINE" not in captured.out
+    assert "METHOD_TRACE_FRAME_ENTRY" not in captured.out
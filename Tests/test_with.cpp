@@ -26,23 +26,118 @@
 #include <catch2/catch.hpp>
 #include "testing_util.h"
 
-// TODO: Enable when ready. Bug on catch for Windows is causing this to fail even though it has mayfail
-// TEST_CASE("Test with statement", "[!mayfail]") {
-//     SECTION("custom context manager case") {
-//         auto t = EmissionTest("def f():\n"
-//                               " class Context:\n"
-//                               "   def __init__(self):\n"
-//                               "       self.entered = False\n"
-//                               "       self.exited = False\n"
-//                               "   def __enter__(self):\n"
-//                               "       self.entered = True \n"
-//                               "       return self\n"
-//                               "   def __exit__(self, *exc):\n"
-//                               "       self.exited = True\n"
-//                               "       return True\n"
-//                               " with Context() as c:\n"
-//                               "    pass\n"
-//                               " return c.entered, c.exited\n");
-//         CHECK(t.returns() == "(True, True)");
-//     }
-// }
+TEST_CASE("Test with statement") {
+    SECTION("custom context manager case") {
+        auto t = EmissionTest("def f():\n"
+                              " class Context:\n"
+                              "   def __init__(self):\n"
+                              "       self.entered = False\n"
+                              "       self.exited = False\n"
+                              "   def __enter__(self):\n"
+                              "       self.entered = True \n"
+                              "       return self\n"
+                              "   def __exit__(self, *exc):\n"
+                              "       self.exited = True\n"
+                              "       return True\n"
+                              " with Context() as c:\n"
+                              "    pass\n"
+                              " return c.entered, c.exited\n");
+        CHECK(t.returns() == "(True, True)");
+    }
+
+    SECTION("exit is called with the exception") {
+        auto t = EmissionTest("def f():\n"
+                              " class Context:\n"
+                              "   def __enter__(self):\n"
+                              "       return self\n"
+                              "   def __exit__(self, exc_type, exc, tb):\n"
+                              "       self.exc_type = exc_type\n"
+                              "       return True\n"
+                              " with Context() as c:\n"
+                              "    1 / 0\n"
+                              " return c.exc_type.__name__\n");
+        CHECK(t.returns() == "'ZeroDivisionError'");
+    }
+
+    SECTION("exception is raised when exit returns false") {
+        auto t = EmissionTest("def f():\n"
+                              " class Context:\n"
+                              "   def __enter__(self):\n"
+                              "       return self\n"
+                              "   def __exit__(self, *exc):\n"
+                              "       return False\n"
+                              " with Context():\n"
+                              "    raise ValueError('fail')\n");
+        CHECK(t.raises() == PyExc_ValueError);
+    }
+
+    SECTION("exception from enter") {
+        auto t = EmissionTest("def f():\n"
+                              " class Context:\n"
+                              "   def __enter__(self):\n"
+                              "       raise KeyError('fail')\n"
+                              "   def __exit__(self, *exc):\n"
+                              "       return True\n"
+                              " with Context():\n"
+                              "    pass\n");
+        CHECK(t.raises() == PyExc_KeyError);
+    }
+
+    SECTION("not a context manager") {
+        auto t = EmissionTest("def f():\n"
+                              " with 1:\n"
+                              "    pass\n");
+        CHECK(t.raises() == PyExc_AttributeError);
+    }
+
+    SECTION("with block in a loop") {
+        auto t = EmissionTest("def f():\n"
+                              " import threading\n"
+                              " lock = threading.Lock()\n"
+                              " total = 0\n"
+                              " for i in range(10):\n"
+                              "    with lock:\n"
+                              "        total += i\n"
+                              " return total, lock.locked()\n");
+        CHECK(t.returns() == "(45, False)");
+    }
+
+    SECTION("return from inside a with block") {
+        auto t = EmissionTest("def f():\n"
+                              " import threading\n"
+                              " lock = threading.Lock()\n"
+                              " def g():\n"
+                              "    with lock:\n"
+                              "        return lock.locked()\n"
+                              " return g(), lock.locked()\n");
+        CHECK(t.returns() == "(True, False)");
+    }
+
+    SECTION("nested with blocks") {
+        auto t = EmissionTest("def f():\n"
+                              " import threading\n"
+                              " a = threading.Lock()\n"
+                              " b = threading.Lock()\n"
+                              " with a, b:\n"
+                              "    inside = a.locked() and b.locked()\n"
+                              " return inside, a.locked(), b.locked()\n");
+        CHECK(t.returns() == "(True, False, False)");
+    }
+}
+
+TEST_CASE("Test with statement PGC") {
+    SECTION("cached enter and exit of a stable type") {
+        auto t = PgcProfilingTest("def f():\n"
+                                  " import threading\n"
+                                  " lock = threading.Lock()\n"
+                                  " with lock:\n"
+                                  "    inside = lock.locked()\n"
+                                  " return inside, lock.locked()\n");
+        CHECK(t.pgcStatus() == PgcStatus::Uncompiled);
+        CHECK(t.returns() == "(True, False)");
+        CHECK(t.pgcStatus() == PgcStatus::CompiledWithProbes);
+        CHECK(t.returns() == "(True, False)");
+        CHECK(t.pgcStatus() == PgcStatus::Optimized);
+        CHECK(t.returns() == "(True, False)");
+    }
+}
@@ -0,0 +1,137 @@
+"""Test the compilation of with blocks"""
+import asyncio
+import sys
+import threading
+import pyjion
+from pyjion.dis import cil_instructions
+
+
+class Context:
+    def __init__(self, suppress=False):
+        self.suppress = suppress
+        self.entered = 0
+        self.exits = []
+
+    def __enter__(self):
+        self.entered += 1
+        return self
+
+    def __exit__(self, exc_type, exc, tb):
+        self.exits.append(exc_type)
+        return self.suppress
+
+
+def test_with_lock():
+    lock = threading.Lock()
+
+    def _f():
+        total = 0
+        for i in range(100):
+            with lock:
+                total += i
+        return total
+
+    for _ in range(3):
+        assert _f() == 4950
+    assert not lock.locked()
+    assert pyjion.info(_f).compiled
+
+
+def test_with_exception_suppressed():
+    def _f(ctx):
+        with ctx:
+            raise ValueError("suppressed")
+        return "after"
+
+    for _ in range(3):
+        ctx = Context(suppress=True)
+        assert _f(ctx) == "after"
+        assert ctx.exits == [ValueError]
+    assert pyjion.info(_f).compiled
+
+
+def test_with_exception_raised():
+    def _f(ctx):
+        with ctx:
+            raise ValueError("raised")
+
+    for _ in range(3):
+        ctx = Context()
+        try:
+            _f(ctx)
+        except ValueError as e:
+            assert e.args == ("raised",)
+        else:
+            assert False, "ValueError not raised"
+        assert ctx.exits == [ValueError]
+    assert sys.exc_info() == (None, None, None)
+
+
+def test_with_return():
+    def _f(ctx):
+        with ctx as c:
+            return c.entered
+
+    ctx = Context()
+    for i in range(3):
+        assert _f(ctx) == i + 1
+    assert ctx.exits == [None, None, None]
+
+
+def _calls(f):
+    return [i.argument for i in cil_instructions(pyjion.il(f), pyjion.symbols(f)) if i.opcode.name == "call"]
+
+
+def test_with_known_type_uses_cached_methods():
+    def _f(ctx):
+        with ctx:
+            pass
+        return ctx.exits
+
+    for _ in range(3):
+        assert _f(Context()) == [None]
+    assert pyjion.info(_f).pgc == pyjion.PgcStatus.Optimized
+    calls = _calls(_f)
+    assert "METHOD_SETUP_WITH_KNOWN_TYPE" in calls
+    assert "METHOD_SETUP_WITH" not in calls
+
+
+def test_with_exit_replaced():
+    class Replaced(Context):
+        pass
+
+    def _f(ctx):
+        with ctx:
+            pass
+        return ctx.exits
+
+    for _ in range(3):
+        assert _f(Replaced()) == [None]
+    Replaced.__exit__ = lambda self, *exc: self.exits.append("replaced")
+    assert _f(Replaced()) == ["replaced"]
+    assert _f(Context()) == [None]
+
+
+def test_async_with():
+    class AsyncContext:
+        def __init__(self):
+            self.exits = []
+
+        async def __aenter__(self):
+            await asyncio.sleep(0)
+            return self
+
+        async def __aexit__(self, exc_type, exc, tb):
+            await asyncio.sleep(0)
+            self.exits.append(exc_type)
+            return True
+
+    async def _f():
+        ctx = AsyncContext()
+        async with ctx:
+            pass
+        async with ctx:
+            raise KeyError("suppressed")
+        return ctx.exits
+
+    assert asyncio.run(_f()) == [None, KeyError]
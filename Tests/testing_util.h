@@ -127,7 +127,7 @@ private:
         Py_DECREF(frame);
         PyGC_Collect();
         REQUIRE(!m_jittedcode->j_failed);
-        REQUIRE(m_jittedcode->j_genericAddr != nullptr);
+        REQUIRE(m_jittedcode->j_addr != nullptr);
         delete profile;
         return res;
     }
@@ -240,7 +240,7 @@ private:
         Py_DECREF(frame);
         size_t collected = PyGC_Collect();
         REQUIRE(!m_jittedcode->j_failed);
-        REQUIRE(m_jittedcode->j_genericAddr != nullptr);
+        REQUIRE(m_jittedcode->j_addr != nullptr);
         return res;
     }
 
@@ -1,7 +1,12 @@
+import atexit
 import ctypes
+import json
 import pathlib
 import os
 import platform
+import inspect
+import sys
+import tempfile
 from enum import IntFlag, IntEnum
 from dataclasses import dataclass
 
@@ -98,10 +103,28 @@ try:
         init as _init,
         symbols,
         config,
+        stats,
+        drain,
+        before_fork as _before_fork,
+        after_fork_child as _after_fork_child,
+        code_heap_allocate as _code_heap_allocate,
+        code_heap_release as _code_heap_release,
+        precompile as _precompile,
+        set_policy as _set_policy,
+        exclude as _exclude,
+        profiles as _profiles,
+        load_profiles as _load_profiles,
+        clear_profiles,
+        shutdown as _shutdown,
         PyjionUnboxingError,
     )
 
     _init(lib_path)
+    atexit.register(_shutdown)
+    # Finish queued compiles in the parent so forked workers share the code instead of each compiling it,
+    # and keep the parent and child from writing to the code memory they share
+    if hasattr(os, "register_at_fork"):
+        os.register_at_fork(before=_before_fork, after_in_child=_after_fork_child)
 except ImportError as i:
     raise ImportError(
         f"""
@@ -144,6 +167,9 @@ class CompilationResult(IntEnum):
     IncompatibleOpcode_With = 104
     IncompatibleOpcode_Unknown = 110
     IncompatibleFrameGlobal = 120
+    NotProfitable_RunOnce = 130
+    NotProfitable_Calls = 131
+    Excluded = 140
 
 
 class PgcStatus(IntEnum):
@@ -165,9 +191,15 @@ class JitInfo:
     compiled: bool
     optimizations: OptimizationFlags
     pgc: PgcStatus
+    baseline: bool
     run_count: int
+    hotness: int
     tracing: bool
     profiling: bool
+    generic_compiled: bool
+    specializations: int
+    guard_failures: int
+    reprofiles: int
 
 
 def info(f) -> JitInfo:
@@ -178,7 +210,143 @@ def info(f) -> JitInfo:
         d["compiled"],
         OptimizationFlags(d["optimizations"]),
         PgcStatus(d["pgc"]),
+        d["baseline"],
         d["run_count"],
+        d["hotness"],
         d["tracing"],
         d["profiling"],
+        d["generic_compiled"],
+        d["specializations"],
+        d["guard_failures"],
+        d["reprofiles"],
     )
+
+
+def _cache_tag() -> str:
+    # Keys are only stable for the same bytecode format and compiler
+    return f"{__version__}-{sys.implementation.cache_tag}-{platform.machine()}"
+
+
+def save_profiles(path) -> None:
+    """
+    Write the PGC profiles recorded by this process, and any loaded with
+    load_profiles(), to path. Observed types are saved by qualified name.
+    """
+    profiles = {str(key): entries for key, entries in _profiles().items()}
+    path = pathlib.Path(path)
+    with tempfile.NamedTemporaryFile("w", dir=path.parent, delete=False) as f:
+        json.dump({"version": _cache_tag(), "profiles": profiles}, f)
+    os.replace(f.name, path)
+
+
+def load_profiles(path) -> bool:
+    """
+    Merge the PGC profiles saved by save_profiles() into this process, so
+    functions are compiled straight to optimized code once they get hot.
+    Loading the files from several processes merges them, a position observed
+    with different types is left unspecialized. Returns False if the file was
+    saved by another version of Pyjion or Python.
+    """
+    with open(path) as f:
+        saved = json.load(f)
+    if saved.get("version") != _cache_tag():
+        return False
+    _load_profiles({int(key): entries for key, entries in saved["profiles"].items()})
+    return True
+
+
+# Types precompile() creates an example of, other types have to be passed as an instance. Calling an
+# arbitrary class could run any code.
+_EXAMPLE_KINDS = (int, float, bool, complex, str, bytes, bytearray, list, dict, tuple, set, frozenset)
+
+
+def _example_argument(kind):
+    if not isinstance(kind, type):
+        return kind
+    if kind not in _EXAMPLE_KINDS:
+        raise TypeError(f"Can't create an example {kind.__name__}, pass an instance instead")
+    return kind()
+
+
+def _precompile_function(func, arg_kinds) -> int:
+    examples = ()
+    if inspect.ismethod(func):
+        if arg_kinds is not None:
+            examples = (func.__self__,) + tuple(_example_argument(kind) for kind in arg_kinds)
+        func = func.__func__
+    elif arg_kinds is not None:
+        examples = tuple(_example_argument(kind) for kind in arg_kinds)
+    return int(_precompile(func.__code__, func.__globals__, examples))
+
+
+def _class_functions(cls):
+    for value in vars(cls).values():
+        if isinstance(value, (staticmethod, classmethod)):
+            value = value.__func__
+        if isinstance(value, property):
+            yield from (f for f in (value.fget, value.fset, value.fdel) if inspect.isfunction(f))
+        elif inspect.isfunction(value):
+            yield value
+        elif inspect.isclass(value) and value.__qualname__.startswith(cls.__qualname__ + "."):
+            yield from _class_functions(value)
+
+
+def precompile(obj, arg_kinds=None) -> int:
+    """
+    Compile a function, method, or every function in a class or module ahead
+    of its first call, so the first call runs native code. arg_kinds gives an
+    example for each argument of a function (excluding self for a bound
+    method), either a builtin type like int, list or str, or an instance. Without it the function is compiled for any argument types.
+    Returns the number of functions compiled.
+    """
+    if inspect.isfunction(obj) or inspect.ismethod(obj):
+        return _precompile_function(obj, arg_kinds)
+    if arg_kinds is not None:
+        raise TypeError("arg_kinds can only be given for a function or method")
+    if inspect.isclass(obj):
+        return sum(_precompile_function(f, None) for f in _class_functions(obj))
+    if inspect.ismodule(obj):
+        compiled = 0
+        for value in list(vars(obj).values()):
+            # Skip anything imported from other modules
+            if getattr(value, "__module__", None) != obj.__name__:
+                continue
+            if inspect.isfunction(value):
+                compiled += _precompile_function(value, None)
+            elif inspect.isclass(value):
+                compiled += sum(_precompile_function(f, None) for f in _class_functions(value))
+        return compiled
+    raise TypeError(f"Can't precompile {type(obj).__name__}, expected a function, method, class or module")
+
+
+def _code_of(func):
+    func = getattr(func, "__func__", func)
+    if not hasattr(func, "__code__"):
+        raise TypeError(f"Expected a function, got {type(func).__name__}")
+    return func.__code__
+
+
+def jit(func=None, *, level: int = None, pgc: bool = None, threshold: int = None):
+    """
+    Compile the decorated function with its own settings, overriding the
+    global optimization level, PGC flag and threshold for it. Settings which
+    aren't given follow pyjion.config(). The function is compiled even if
+    its module is excluded by pyjion.config(exclude_modules=...).
+
+    Use as @pyjion.jit or @pyjion.jit(level=2, ...).
+    """
+    def apply(f):
+        _set_policy(_code_of(f), level, pgc, threshold)
+        return f
+
+    if func is not None:
+        return apply(func)
+    return apply
+
+
+def nojit(func):
+    """
+    Never compile the decorated function, it always runs in the interpreter.
+    """
+    _exclude(_code_of(func))
+    return func
@@ -1,4 +1,5 @@
-from typing import Dict, Any, Callable, Optional, Union
+import os
+from typing import Dict, Any, Callable, List, Optional, Sequence, TypeVar, Union
 
 from pyjion import JitInfo, CompileMode
 
@@ -40,7 +41,62 @@ def info(f: Callable) -> JitInfo:
     """
     ...
 
-def config(pgc: Optional[bool], level: Optional[int], debug: Optional[Union[bool, CompileMode]], graph: Optional[bool], threshold: Optional[int], ) -> Dict[str, Any]:
+def config(pgc: Optional[bool], level: Optional[int], debug: Optional[Union[bool, CompileMode]], graph: Optional[bool], threshold: Optional[int], async_compile: Optional[bool], lazy_generic: Optional[bool], max_specializations: Optional[int], reprofile_threshold: Optional[int], max_reprofiles: Optional[int], osr_threshold: Optional[int], loop_weight: Optional[int], tier_up_threshold: Optional[int], compile_budget_ms_per_sec: Optional[int], cost_model: Optional[bool], exception_handling: Optional[bool], compile_cache_size: Optional[int], include_modules: Optional[List[str]], exclude_modules: Optional[List[str]], ) -> Dict[str, Any]:
+    ...
+
+def stats() -> Dict[str, int]:
+    """
+    Global compilation counters.
+
+    :returns: ``compiled`` (functions with a compiled body), ``generic_compiled`` (functions which also needed a generic body)
+        ``generic_skipped`` (functions which never needed one), ``specializations`` (additional specialized variants compiled),
+        ``deoptimizations`` (frames handed back to the interpreter on a failed guard) ``reprofiles`` (functions profiled again)
+        and ``osr_entries`` (running frames moved into optimized code at a loop header).
+    """
+    ...
+
+def drain() -> None:
+    """
+    Block until every function queued for background compilation (``async_compile=True``) has been compiled.
+    """
+    ...
+
+F = TypeVar("F", bound=Callable)
+
+def jit(func: Optional[F] = None, *, level: Optional[int] = None, pgc: Optional[bool] = None, threshold: Optional[int] = None) -> F:
+    """
+    Compile the decorated function with its own optimization level, PGC flag and threshold.
+    Settings which aren't given follow :func:`config`.
+    """
+    ...
+
+def nojit(func: F) -> F:
+    """
+    Never compile the decorated function.
+    """
+    ...
+
+def precompile(obj: Any, arg_kinds: Optional[Sequence[Any]] = None) -> int:
+    """
+    Compile a function or method, or every function defined in a class or module, before its first call.
+
+    :param arg_kinds: An example for each argument of a function, a type like ``int`` or an instance.
+    :returns: The number of functions compiled.
+    """
+    ...
+
+def save_profiles(path: Union[str, os.PathLike]) -> None:
+    """
+    Write the PGC profiles recorded by this process, and any loaded with :func:`load_profiles`, to ``path``.
+    """
+    ...
+
+def load_profiles(path: Union[str, os.PathLike]) -> bool:
+    """
+    Merge PGC profiles written by :func:`save_profiles`. Functions with a profile skip the probed compile.
+
+    :returns: False if the file was written by another version of Pyjion or Python.
+    """
     ...
 
 def offsets(f: Callable) -> tuple[tuple[int, int, int, int]]:
@@ -28,6 +28,7 @@
 #include <object.h>
 #include <deque>
 #include <set>
+#include <unordered_set>
 #include <unordered_map>
 #include <algorithm>
 
@@ -35,8 +36,9 @@
 #include "pyjit.h"
 #include "pycomp.h"
 #include "attrtable.h"
+#include "unboxing.h"
 
-#define PGC_READY() g_pyjionSettings.pgc&& profile != nullptr
+#define PGC_READY() PyJit_PgcEnabled() && profile != nullptr
 
 #define PGC_PROBE(count) \
     pgcRequired = true;  \
@@ -64,14 +66,18 @@
 #define FLAG_OPT_USAGE(opt) (optimizationsMade = optimizationsMade | (opt))
 
 #define CUR_HANDLER m_blockStack.back().CurrentHandler
+// Generator and coroutine frames are suspended and resumed, so their state has to live in the frame
+#define SUSPENDABLE(code) (((code)->co_flags & (CO_GENERATOR | CO_COROUTINE)) != 0)
 
 AbstractInterpreter::AbstractInterpreter(PyCodeObject* code) : mCode(code) {
     mGlobalsVersion = 0;
     mBuiltinsVersion = 0;
     mByteCode = (_Py_CODEUNIT*) PyBytes_AS_STRING(code->co_code);
     mSize = PyBytes_Size(code->co_code);
+    mRegion = false;
     mTracingEnabled = false;
     mProfilingEnabled = false;
+    mBaseline = false;
     m_comp = nullptr;
     initStartingState();
 }
@@ -83,10 +89,9 @@ AbstractInterpreter::~AbstractInterpreter() {
     }
 }
 
-AbstractInterpreterPreprocessResult AbstractInterpreter::preprocess() {
-    if (mCode->co_flags & (CO_COROUTINE | CO_ITERABLE_COROUTINE | CO_ASYNC_GENERATOR)) {
-        // Don't compile co-routines or generators.  We can't rely on
-        // detecting yields because they could be optimized out.
+AbstractInterpreterPreprocessResult AbstractInterpreter::preprocess(PyjionCodeProfile* profile) {
+    if (mCode->co_flags & CO_ASYNC_GENERATOR) {
+        // Values yielded by async generators are wrapped by the interpreter
         return {IncompatibleCompilerFlags};
     }
 
@@ -95,12 +100,20 @@ AbstractInterpreterPreprocessResult AbstractInterpreter::preprocess() {
         m_assignmentState[i] = true;
     }
     if (mSize >= g_pyjionSettings.codeObjectSizeLimit) {
-        return {IncompatibleSize};
+        // Compile a region from the start of the function instead, the interpreter picks up the rest
+        py_opindex regionEnd = SUSPENDABLE(mCode) ? 0 : findRegionEnd();
+        if (regionEnd == 0)
+            return {IncompatibleSize};
+        mSize = regionEnd;
+        mRegion = true;
     }
 
     py_oparg oparg;
     vector<bool> ehKind;
     AbstractBlockList blockStarts;
+    // Inputs to the cost model
+    size_t instructions = 0, specializable = 0, calls = 0;
+    bool hasLoops = false;
     for (py_opindex curByte = 0; curByte < mSize; curByte += SIZEOF_CODEUNIT) {
         py_opindex opcodeIndex = curByte;
         auto byte = GET_OPCODE(curByte);
@@ -141,8 +154,6 @@ AbstractInterpreterPreprocessResult AbstractInterpreter::preprocess() {
                 }
                 break;
             }
-            case YIELD_FROM:
-                return {IncompatibleOpcode_Yield};
             case DELETE_FAST:
                 if (oparg < mCode->co_argcount) {
                     // this local is deleted, so we need to check for assignment
@@ -157,19 +168,78 @@ AbstractInterpreterPreprocessResult AbstractInterpreter::preprocess() {
                     !strcmp(name, "locals") ||
                     !strcmp(name, "eval") ||
                     !strcmp(name, "exec")) {
-                    // TODO: Support for frame globals
-                    // In the future we might be able to do better, e.g. keep locals in fast locals,
-                    // but for now this is a known limitation that if you load vars/dir we won't
-                    // optimize your code, and if you alias them you won't get the correct behavior.
-                    // Longer term we should patch vars/dir/_getframe and be able to provide the
-                    // correct values from generated code.
-#ifdef DEBUG_VERBOSE
-                    printf("Skipping function because it contains frame globals.");
-#endif
-                    return {IncompatibleFrameGlobal};
+                    // These read the frame's locals, so unboxed locals are written back to the frame
+                    // when one is loaded. If you alias them you won't get the correct behavior.
+                    mFrameGlobals[oparg] = nullptr;
                 }
             } break;
         }
+
+        instructions++;
+        switch (byte) {// NOLINT(hicpp-multiway-paths-covered)
+            case JUMP_ABSOLUTE:
+            case POP_JUMP_IF_FALSE:
+            case POP_JUMP_IF_TRUE:
+            case JUMP_IF_FALSE_OR_POP:
+            case JUMP_IF_TRUE_OR_POP:
+                if (jumpsTo(byte, oparg, curByte) <= opcodeIndex)
+                    hasLoops = true;
+                break;
+            case CALL_FUNCTION:
+            case CALL_FUNCTION_KW:
+            case CALL_FUNCTION_EX:
+            case CALL_METHOD:
+            case IMPORT_NAME:
+                calls++;
+                break;
+            case BINARY_ADD:
+            case BINARY_SUBTRACT:
+            case BINARY_MULTIPLY:
+            case BINARY_TRUE_DIVIDE:
+            case BINARY_FLOOR_DIVIDE:
+            case BINARY_MODULO:
+            case BINARY_POWER:
+            case BINARY_LSHIFT:
+            case BINARY_RSHIFT:
+            case BINARY_AND:
+            case BINARY_OR:
+            case BINARY_XOR:
+            case INPLACE_ADD:
+            case INPLACE_SUBTRACT:
+            case INPLACE_MULTIPLY:
+            case INPLACE_TRUE_DIVIDE:
+            case INPLACE_FLOOR_DIVIDE:
+            case INPLACE_MODULO:
+            case INPLACE_POWER:
+            case INPLACE_LSHIFT:
+            case INPLACE_RSHIFT:
+            case INPLACE_AND:
+            case INPLACE_OR:
+            case INPLACE_XOR:
+            case UNARY_NOT:
+            case UNARY_NEGATIVE:
+            case COMPARE_OP:
+            case IS_OP:
+            case BINARY_SUBSCR:
+            case STORE_SUBSCR:
+            case LOAD_ATTR:
+            case UNPACK_SEQUENCE:
+            case FOR_ITER:
+                // Once profiled, only count the instructions which saw types they can be specialized for
+                if (profile == nullptr || !profile->onlyObjects(curByte))
+                    specializable++;
+                break;
+        }
+    }
+
+    // Code without loops has to make up for the compile in a handful of runs. Module and class bodies
+    // only run once, so they never do.
+    if (!hasLoops && !(mCode->co_flags & CO_OPTIMIZED)) {
+        return {NotProfitable_RunOnce};
+    }
+    // Calls cost the same from compiled code, so a function which mostly calls out gains little.
+    if (g_pyjionSettings.costModel && !hasLoops && calls > 0 && calls >= specializable && specializable * 4 < instructions) {
+        return {NotProfitable_Calls};
     }
     if (OPT_ENABLED(HashedNames)) {
         for (Py_ssize_t i = 0; i < PyTuple_Size(mCode->co_names); i++) {
@@ -179,6 +249,71 @@ AbstractInterpreterPreprocessResult AbstractInterpreter::preprocess() {
     return {Success};
 }
 
+// Finds the furthest point within codeObjectSizeLimit where the interpreter can take over the frame:
+// the value stack is empty, no jump or exception handler in the region leads past it and the region
+// has at least one loop. Returns 0 when there's no such point. Regions always start at the function's
+// entry, the interpreter can hand a frame over to compiled code only when it starts.
+py_opindex AbstractInterpreter::findRegionEnd() {
+    unordered_map<py_opindex, int> depthAt;
+    py_opindex limit = g_pyjionSettings.codeObjectSizeLimit;
+    py_opindex furthestJump = 0, regionEnd = 0;
+    int depth = 0;
+    bool reachable = true, hasLoops = false;
+    for (py_opindex curByte = 0; curByte < mSize && curByte < limit; curByte += SIZEOF_CODEUNIT) {
+        py_opindex opcodeIndex = curByte;
+        auto known = depthAt.find(opcodeIndex);
+        if (known != depthAt.end()) {
+            depth = known->second;
+            reachable = true;
+        }
+        if (reachable && depth == 0 && hasLoops && furthestJump <= opcodeIndex)
+            regionEnd = opcodeIndex;
+
+        auto byte = GET_OPCODE(curByte);
+        py_oparg oparg = GET_OPARG(curByte);
+        while (byte == EXTENDED_ARG && curByte + SIZEOF_CODEUNIT < mSize) {
+            curByte += SIZEOF_CODEUNIT;
+            oparg = (oparg << 8) | GET_OPARG(curByte);
+            byte = GET_OPCODE(curByte);
+        }
+        switch (byte) {// NOLINT(hicpp-multiway-paths-covered)
+            case SETUP_FINALLY:
+            case SETUP_WITH:
+            case SETUP_ASYNC_WITH:
+                // The handler has to be inside the region, not at its end
+                furthestJump = std::max(furthestJump, (py_opindex) (jumpsTo(byte, oparg, curByte) + SIZEOF_CODEUNIT));
+                depthAt.emplace(jumpsTo(byte, oparg, curByte), depth + PyCompile_OpcodeStackEffectWithJump(byte, oparg, 1));
+                break;
+            case JUMP_ABSOLUTE:
+            case JUMP_FORWARD:
+            case POP_JUMP_IF_FALSE:
+            case POP_JUMP_IF_TRUE:
+            case JUMP_IF_FALSE_OR_POP:
+            case JUMP_IF_TRUE_OR_POP:
+            case JUMP_IF_NOT_EXC_MATCH:
+            case FOR_ITER: {
+                auto target = jumpsTo(byte, oparg, curByte);
+                if (target <= opcodeIndex)
+                    hasLoops = true;
+                furthestJump = std::max(furthestJump, target);
+                depthAt.emplace(target, depth + PyCompile_OpcodeStackEffectWithJump(byte, oparg, 1));
+                break;
+            }
+        }
+        depth += PyCompile_OpcodeStackEffectWithJump(byte, oparg, 0);
+        switch (byte) {// NOLINT(hicpp-multiway-paths-covered)
+            case JUMP_ABSOLUTE:
+            case JUMP_FORWARD:
+            case RETURN_VALUE:
+            case RAISE_VARARGS:
+            case RERAISE:
+                reachable = false;
+                break;
+        }
+    }
+    return regionEnd;
+}
+
 void AbstractInterpreter::setLocalType(size_t index, PyObject* val) {
     auto& lastState = mStartStates[0];
     if (val != nullptr) {
@@ -219,7 +354,7 @@ void AbstractInterpreter::initStartingState() {
 
 AbstractInterpreterResult
 AbstractInterpreter::interpret(PyObject* builtins, PyObject* globals, PyjionCodeProfile* profile, PgcStatus pgc_status) {
-    auto preprocessResult = preprocess();
+    auto preprocessResult = preprocess(profile);
     if (preprocessResult.result != Success) {
         return preprocessResult.result;
     }
@@ -235,6 +370,8 @@ AbstractInterpreter::interpret(PyObject* builtins, PyObject* globals, PyjionCode
 
     for (Py_ssize_t i = 0; i < PyTuple_Size(mCode->co_names); i++)
         utf8_names.emplace_back(PyUnicode_AsUTF8(PyTuple_GetItem(mCode->co_names, i)));
+    for (auto& frameGlobal : mFrameGlobals)
+        frameGlobal.second = PyDict_GetItem(builtins, PyTuple_GetItem(mCode->co_names, frameGlobal.first));
     // Keep a list of SETUP_FINALLY instructions and their offsets, to push the exception values onto the stack
     unordered_map<py_opindex, py_opindex> tryExceptMarkers;
     do {
@@ -371,7 +508,7 @@ AbstractInterpreter::interpret(PyObject* builtins, PyObject* globals, PyjionCode
                     break;
                 }
                 case STORE_FAST: {
-                    if (PGC_READY() && g_pyjionSettings.optimizationLevel >= 2) {
+                    if (PGC_READY() && PyJit_OptimizationLevel() >= 2) {
                         PGC_PROBE(1);
                         PGC_UPDATE_STACK(1);
                     }
@@ -803,9 +940,15 @@ AbstractInterpreter::interpret(PyObject* builtins, PyObject* globals, PyjionCode
                     skipEffect = true;
                     break;
                 }
-                case POP_BLOCK:
+                case POP_BLOCK: {
+                    auto blockStart = m_blockStarts.find(opcodeIndex);
+                    if (blockStart != m_blockStarts.end() &&
+                        (GET_OPCODE(blockStart->second) == SETUP_WITH || GET_OPCODE(blockStart->second) == SETUP_ASYNC_WITH))
+                        // Falls through to the call to __exit__, which stays on the stack
+                        break;
                     lastState.mStack = mStartStates[m_blockStarts[opcodeIndex]].mStack;
                     goto next_block;
+                }
                 case POP_EXCEPT:
                     POP_VALUE();
                     POP_VALUE();
@@ -849,12 +992,27 @@ AbstractInterpreter::interpret(PyObject* builtins, PyObject* globals, PyjionCode
                     PUSH_INTERMEDIATE(&String);
                     break;
                 }
+                case BEFORE_ASYNC_WITH:
+                    POP_VALUE();
+                    PUSH_INTERMEDIATE(&Any);// __aexit__
+                    PUSH_INTERMEDIATE(&Any);// the awaitable from __aenter__
+                    break;
                 case SETUP_ASYNC_WITH:
                 case SETUP_WITH: {
-                    auto finallyState = lastState;
-                    PUSH_INTERMEDIATE_TO(&Any, finallyState);
-                    if (updateStartState(finallyState, jumpsTo(opcode, oparg, opcodeIndex))) {
-                        jump = 1;
+                    if (opcode == SETUP_WITH) {
+                        if (PGC_READY()) {
+                            PGC_PROBE(1);
+                            PGC_UPDATE_STACK(1);
+                        }
+                        POP_VALUE();// the context manager
+                        PUSH_INTERMEDIATE(&Any);// __exit__
+                    } else {
+                        POP_VALUE();// the result of __aenter__, pushed back after the block
+                    }
+                    // The handler is entered with __exit__ and the exception values on the stack
+                    tryExceptMarkers[jumpsTo(opcode, oparg, opcodeIndex)] = curByte;
+                    auto handlerState = lastState;
+                    if (updateStartState(handlerState, jumpsTo(opcode, oparg, opcodeIndex))) {
                         queue.emplace_back(jumpsTo(opcode, oparg, opcodeIndex));
                     }
                     PUSH_INTERMEDIATE(&Any);
@@ -928,16 +1086,15 @@ AbstractInterpreter::interpret(PyObject* builtins, PyObject* globals, PyjionCode
                     PUSH_INTERMEDIATE(&Bool);
                     break;
                 case WITH_EXCEPT_START: {
-                    // TODO: Implement WITH_EXCEPT_START
                     /* At the top of the stack are 7 values:
                        - (TOP, SECOND, THIRD) = exc_info()
                        - (FOURTH, FIFTH, SIXTH) = previous exception for EXCEPT_HANDLER
                        - SEVENTH: the context.__exit__ bound method
                        We call SEVENTH(TOP, SECOND, THIRD).
-                       Then we push again the TOP exception and the __exit__
-                       return value.
+                       Then we push the __exit__ return value.
                     */
-                    return IncompatibleOpcode_WithExcept;// not implemented
+                    PUSH_INTERMEDIATE(&Any);
+                    break;
                 }
                 case LIST_EXTEND: {
                     POP_VALUE();
@@ -971,6 +1128,26 @@ AbstractInterpreter::interpret(PyObject* builtins, PyObject* globals, PyjionCode
                     POP_VALUE();
                     PUSH_INTERMEDIATE(&Any);
                     break;// No stack effect
+                case YIELD_FROM:
+                    POP_VALUE();// value sent
+                    POP_VALUE();// receiver
+                    PUSH_INTERMEDIATE(&Any);
+                    break;
+                case GET_AWAITABLE:
+                case GET_AITER:
+                case GET_YIELD_FROM_ITER:
+                    POP_VALUE();
+                    PUSH_INTERMEDIATE(&Any);
+                    break;
+                case GET_ANEXT:
+                    PUSH_INTERMEDIATE(&Any);
+                    break;
+                case END_ASYNC_FOR:
+                    // The exception, the previous exception and the async iterator
+                    for (int i = 0; i < 7; i++) {
+                        POP_VALUE();
+                    }
+                    break;
                 case GEN_START:
                     skipEffect = true;
                     break;
@@ -1158,24 +1335,60 @@ AbstractSource* AbstractInterpreter::addConstSource(py_opindex opcodeIndex, py_o
 // Checks to see if we have a non-zero error code on the stack, and if so,
 // branches to the current error handler.  Consumes the error code in the process
 void AbstractInterpreter::intErrorCheck(ExceptionHandler* handler, const char* reason, const char* context, py_opindex curByte) {
-    auto noErr = m_comp->emit_define_label();
-    m_comp->emit_branch(BranchFalse, noErr);
-    branchRaise(handler, reason, context, curByte);
-    m_comp->emit_mark_label(noErr);
+    m_comp->emit_branch(BranchTrue, raiseLabel(handler, RaiseNoResult, reason, context, curByte));
 }
 
 // Checks to see if we have a null value as the last value on our stack
 // indicating an error, and if so, branches to our current error handler.
 void AbstractInterpreter::errorCheck(ExceptionHandler* handler, const char* reason, const char* context, py_opindex curByte) {
-    auto noErr = m_comp->emit_define_label();
     m_comp->emit_dup();
-    m_comp->emit_store_local(mErrorCheckLocal);
-    m_comp->emit_null();
-    m_comp->emit_branch(BranchNotEqual, noErr);
+    m_comp->emit_branch(BranchFalse, raiseLabel(handler, RaiseObjectResult, reason, context, curByte));
+}
 
-    branchRaise(handler, reason, context, curByte);
-    m_comp->emit_mark_label(noErr);
-    m_comp->emit_load_local(mErrorCheckLocal);
+// Returns the label of a raise path for the current stack, which is emitted with the
+// rest of the raise paths after the method body.
+Label AbstractInterpreter::raiseLabel(ExceptionHandler* handler, RaiseResult result, const char* reason, const char* context, py_opindex curByte, bool force, bool trace) {
+    Label raise;
+    bool shared = false;
+    // Branches which share a raise path need the same stack types, unboxed ints can be 32 or 64-bit
+    if (std::find(m_stack.begin(), m_stack.end(), STACK_KIND_VALUE_INT) == m_stack.end()) {
+        for (auto& pending : m_pendingRaises) {
+            if (pending.handler == handler && pending.result == result && pending.force == force && pending.trace == trace &&
+                pending.stack.size() == m_stack.size() && std::equal(m_stack.begin(), m_stack.end(), pending.stack.begin())) {
+                raise = pending.target;
+                shared = true;
+                break;
+            }
+        }
+    }
+    if (!shared) {
+        raise = m_comp->emit_define_label();
+        m_pendingRaises.push_back({raise, handler, ValueStack(m_stack), result, force, trace, reason, context, curByte});
+    }
+#ifdef DEBUG_VERBOSE
+    // The shared path reports the first site, every other site reports itself before joining it
+    if (shared) {
+        m_pendingRaiseSites.push_back({m_comp->emit_define_label(), raise, reason, context, curByte});
+        return m_pendingRaiseSites.back().target;
+    }
+#endif
+    return raise;
+}
+
+void AbstractInterpreter::emitPendingRaises() {
+    for (auto& site : m_pendingRaiseSites) {
+        m_comp->emit_mark_label(site.target);
+        if (site.reason != nullptr)
+            m_comp->emit_debug_fault(site.reason, site.context, site.curByte);
+        m_comp->emit_branch(BranchAlways, site.raise);
+    }
+    for (auto& pending : m_pendingRaises) {
+        m_comp->emit_mark_label(pending.target);
+        m_stack = ValueStack(pending.stack);
+        if (pending.result != RaiseNoResult)
+            m_comp->emit_pop();
+        branchRaise(pending.handler, pending.reason, pending.context, pending.curByte, pending.force, pending.trace);
+    }
 }
 
 void AbstractInterpreter::invalidFloatErrorCheck(ExceptionHandler* handler, const char* reason, py_opindex curByte, py_opcode opcode) {
@@ -1232,49 +1445,14 @@ void AbstractInterpreter::branchRaise(ExceptionHandler* handler, const char* rea
     if (mTracingEnabled)
         m_comp->emit_trace_exception();
 
-    // number of stack entries we need to clear...
-    auto count = static_cast<ssize_t>(m_stack.size() - entryStack.size());
-
+    // number of stack entries we need to clear, objects are released and unboxed values dropped
+    ssize_t count = m_stack.size() > entryStack.size() ? static_cast<ssize_t>(m_stack.size() - entryStack.size()) : 0;
     auto cur = m_stack.rbegin();
-    for (; cur != m_stack.rend() && count >= 0; cur++) {
+    for (ssize_t i = 0; i < count; cur++, i++) {
         if (*cur != STACK_KIND_OBJECT || force) {
-            count--;
             m_comp->emit_pop();
         } else {
-            break;
-        }
-    }
-
-    if (!count || count < 0) {
-        // No values on the stack, we can just branch directly to the raise label
-        m_comp->emit_branch(BranchAlways, handler->ErrorTarget);
-        return;
-    }
-
-    while (m_raiseAndFree.size() <= handler->RaiseAndFreeId) {
-        m_raiseAndFree.emplace_back();
-    }
-
-    vector<Label>& labels = m_raiseAndFree[handler->RaiseAndFreeId];
-
-    for (auto i = labels.size(); i < count; i++) {
-        labels.emplace_back(m_comp->emit_define_label());
-    }
-    while (m_raiseAndFreeLocals.size() <= count) {
-        m_raiseAndFreeLocals.emplace_back(m_comp->emit_define_local());
-    }
-
-    // continue walking our stack iterator
-    for (auto i = 0; i < count; cur++, i++) {
-        if (*cur != STACK_KIND_OBJECT || force) {
-            // pop off the stack value...
-            m_comp->emit_pop();
-
-            // and store null into our local that needs to be freed
-            m_comp->emit_null();
-            m_comp->emit_store_local(m_raiseAndFreeLocals[i]);
-        } else {
-            m_comp->emit_store_local(m_raiseAndFreeLocals[i]);
+            m_comp->emit_pop_top();
         }
     }
     m_comp->emit_branch(BranchAlways, handler->ErrorTarget);
@@ -1319,18 +1497,286 @@ void AbstractInterpreter::incStack(size_t size, LocalKind kind) {
 void AbstractInterpreter::raiseOnNegativeOne(ExceptionHandler* handler, py_opindex curByte) {
     m_comp->emit_dup();
     m_comp->emit_int(-1);
+    m_comp->emit_branch(BranchEqual, raiseLabel(handler, RaiseIntResult, "last operation failed", "", curByte));
+}
 
-    auto noErr = m_comp->emit_define_label();
-    m_comp->emit_branch(BranchNotEqual, noErr);
-    // we need to issue a leave to clear the stack as we may have
-    // values on the stack...
+bool AbstractInterpreter::canDeoptimize(const vector<Edge>& edges, py_opindex curByte, size_t blockDepth) {
+    // The interpreter has to be able to pick up the frame exactly where we leave it,
+    // so anything that only exists in the jitted code's view of the frame rules it out.
+    if (mTracingEnabled || mProfilingEnabled)
+        return false;
+    // Blocks are only tracked at compile time, f_blockstack is empty
+    if (blockDepth != 1)
+        return false;
+    // LOAD_METHOD leaves self and the method in the opposite order to CPython
+    if (m_pendingMethodCalls != 0)
+        return false;
+    if (edges.size() > m_stack.size())
+        return false;
+
+    bool guarded = false;
+    for (size_t i = 0; i < m_stack.size(); i++) {
+        if (i >= edges.size()) {
+            if (m_stack.peek(i) != STACK_KIND_OBJECT)
+                return false;
+            continue;
+        }
+        switch (edges[i].escaped) {
+            case NoEscape:
+                if (m_stack.peek(i) != STACK_KIND_OBJECT)
+                    return false;
+                break;
+            case Unbox:
+                if (m_stack.peek(i) != STACK_KIND_OBJECT)
+                    return false;
+                if (edges[i].value->needsGuard())
+                    guarded = true;
+                break;
+            case Box:
+            case Unboxed:
+                if (!supportsEscaping(edges[i].value->kind()))
+                    return false;
+                break;
+        }
+    }
+    if (!guarded)
+        return false;
 
-    m_comp->emit_pop();
-    branchRaise(handler, "last operation failed", "", curByte);
-    m_comp->emit_mark_label(noErr);
+    // Every unboxed local has to hold a value we can box back into the frame
+    for (auto& local : m_fastNativeLocals) {
+        if (!m_assignmentState[local.first])
+            return false;
+    }
+    return true;
+}
+
+void AbstractInterpreter::emitDeoptimizationGuards(const vector<Edge>& edges, py_opindex curByte, Local retValue, Label retLabel) {
+    size_t depth = m_stack.size();
+    vector<Local> stack = vector<Local>(depth);
+    auto deoptimize = m_comp->emit_define_label();
+    auto guardsPassed = m_comp->emit_define_label();
+
+    for (size_t i = 0; i < depth; i++) {
+        if (i < edges.size() && (edges[i].escaped == Box || edges[i].escaped == Unboxed))
+            stack[i] = m_comp->emit_define_local(edges[i].value->kind());
+        else
+            stack[i] = m_comp->emit_define_local(LK_Pointer);
+        m_comp->emit_store_local(stack[i]);
+    }
+    for (size_t i = 0; i < edges.size(); i++) {
+        if (edges[i].escaped == Unbox && edges[i].value->needsGuard()) {
+            m_comp->emit_load_local(stack[i]);
+            m_comp->emit_guard_check(edges[i].value->kind());
+            m_comp->emit_branch(BranchFalse, deoptimize);
+        }
+    }
+    // Recover the stack in the right order
+    for (size_t i = depth; i > 0; --i) {
+        m_comp->emit_load_local(stack[i - 1]);
+    }
+    m_comp->emit_branch(BranchAlways, guardsPassed);
+
+    // Rebuild the frame as the interpreter would have it before this instruction
+    m_comp->emit_mark_label(deoptimize);
+    for (size_t i = 0; i < depth; i++) {
+        m_comp->emit_load_local(stack[i]);
+        if (i < edges.size() && (edges[i].escaped == Box || edges[i].escaped == Unboxed))
+            m_comp->emit_box(edges[i].value->kind());
+        else if (isUnboxedRangeIterator(curByte, i))
+            m_comp->emit_box_range_iterator();
+        m_comp->emit_store_in_frame_value_stack(depth - 1 - i);
+    }
+    storeFastNativeLocals();
+    // Resume at the first EXTENDED_ARG of this instruction so the oparg is rebuilt
+    py_opindex resumeIndex = curByte;
+    while (resumeIndex >= SIZEOF_CODEUNIT && GET_OPCODE(resumeIndex - SIZEOF_CODEUNIT) == EXTENDED_ARG)
+        resumeIndex -= SIZEOF_CODEUNIT;
+    m_comp->emit_deoptimize(resumeIndex, depth);
+    m_comp->emit_store_local(retValue);
+    m_comp->emit_branch(BranchAlways, retLabel);
+
+    m_comp->emit_mark_label(guardsPassed);
+    for (auto& local : stack) {
+        m_comp->emit_free_local(local);
+    }
+}
+
+bool AbstractInterpreter::isUnboxedRangeIterator(py_opindex curByte, size_t stackIndex) {
+    auto& stackInfo = getStackInfo(curByte);
+    if (stackIndex >= stackInfo.size())
+        return false;
+    auto& value = stackInfo[stackInfo.size() - 1 - stackIndex];
+    return value.hasValue() && value.Value->kind() == AVK_UnboxedRangeIterator;
+}
+
+// Pushes a block whose handler at handlerIndex is entered with the current stack and the
+// exception and previous exception values on top of it.
+void AbstractInterpreter::pushFinallyBlock(ExceptionHandlerManager& handlers, BlockStack& blockStack, unordered_map<py_opindex, ValueStack>& offsetStack, py_opindex handlerIndex) {
+    auto handlerLabel = m_comp->emit_define_label();
+    auto newHandler = handlers.AddSetupFinallyHandler(
+            handlerLabel,
+            m_stack,
+            blockStack.back().CurrentHandler,
+            handlerIndex);
+
+    auto newBlock = BlockInfo(
+            handlerIndex,
+            SETUP_FINALLY,
+            newHandler);
+
+    blockStack.emplace_back(newBlock);
+    m_comp->emit_push_block(SETUP_FINALLY, handlerIndex, 0);
+
+    ValueStack newStack = ValueStack(m_stack);
+    newStack.inc(6, STACK_KIND_OBJECT);
+    // This stack only gets used if an error occurs within the block:
+    offsetStack[handlerIndex] = newStack;
+}
+
+// Boxes the unboxed fast locals back into the frame, for handing it to other code.
+void AbstractInterpreter::storeFastNativeLocals() {
+    for (auto& local : m_fastNativeLocals) {
+        m_comp->emit_load_local(local.second);
+        m_comp->emit_box(m_fastNativeLocalValueKinds[local.first]);
+        m_comp->emit_store_fast(local.first);
+    }
+}
+
+// Boxes the unboxed fast locals into the frame if the global just loaded (on the top of the stack) is
+// the builtin, so that it sees their current values. The jitted code keeps using the unboxed values.
+void AbstractInterpreter::emitFrameGlobalFlush(py_oparg nameIndex, py_opindex curByte) {
+    auto skip = m_comp->emit_define_label();
+    auto builtin = mFrameGlobals[nameIndex];
+    if (builtin != nullptr) {
+        m_comp->emit_dup();
+        m_comp->emit_ptr(builtin);
+        m_comp->emit_branch(BranchNotEqual, skip);
+    }
+    for (auto& local : m_fastNativeLocals) {
+        // An unassigned local stays out of the frame
+        if (getLocalInfo(curByte, local.first).IsMaybeUndefined)
+            continue;
+        m_comp->emit_load_local(local.second);
+        m_comp->emit_box(m_fastNativeLocalValueKinds[local.first]);
+        m_comp->emit_store_fast(local.first);
+    }
+    m_comp->emit_mark_label(skip);
 }
 
-void AbstractInterpreter::escapeEdges(ExceptionHandler* handler, const vector<Edge>& edges, py_opindex curByte) {
+bool AbstractInterpreter::argumentsReassigned() {
+    auto argCount = mCode->co_argcount + mCode->co_kwonlyargcount;
+    for (py_opindex curByte = 0; curByte < mSize; curByte += SIZEOF_CODEUNIT) {
+        auto opcode = GET_OPCODE(curByte);
+        if ((opcode == STORE_FAST || opcode == DELETE_FAST) && GET_OPARG(curByte) < argCount)
+            return true;
+    }
+    return false;
+}
+
+// A loop header can be handed between variants when the frame holds the whole state at that point.
+bool AbstractInterpreter::canReplaceOnStack(size_t blockDepth) {
+    if (blockDepth != 1 || m_pendingMethodCalls != 0)
+        return false;
+    for (size_t i = 0; i < m_stack.size(); i++) {
+        if (m_stack.peek(i) != STACK_KIND_OBJECT)
+            return false;
+    }
+    return true;
+}
+
+void AbstractInterpreter::emitOsrTransfer(py_opindex curByte, Local counter, Local retValue, Label retLabel) {
+    auto notHot = m_comp->emit_define_label();
+    auto notReady = m_comp->emit_define_label();
+    size_t depth = m_stack.size();
+
+    m_comp->emit_inc_local(counter, 1);
+    m_comp->emit_load_local(counter);
+    m_comp->emit_sizet(g_pyjionSettings.osrThreshold);
+    m_comp->emit_branch(BranchLessThanUnsigned, notHot);
+
+    m_comp->emit_prepare_on_stack_replace();
+    m_comp->emit_branch(BranchFalse, notReady);
+    for (size_t i = 0; i < depth; i++) {
+        if (isUnboxedRangeIterator(curByte, i))
+            m_comp->emit_box_range_iterator();
+        m_comp->emit_store_in_frame_value_stack(depth - 1 - i);
+    }
+    storeFastNativeLocals();
+    m_comp->emit_on_stack_replace(curByte, depth);
+    m_comp->emit_store_local(retValue);
+    m_comp->emit_branch(BranchAlways, retLabel);
+
+    // Try again after another osrThreshold iterations
+    m_comp->emit_mark_label(notReady);
+    m_comp->emit_sizet(0);
+    m_comp->emit_store_local(counter);
+    m_comp->emit_mark_label(notHot);
+}
+
+void AbstractInterpreter::emitOsrEntry(py_opindex target, size_t depth, Label body, Local retValue, Label retLabel) {
+    auto bail = m_comp->emit_define_label();
+
+    // Check everything before taking anything out of the frame, so bailing out leaves it intact
+    for (auto& local : m_fastNativeLocals) {
+        auto unassigned = m_comp->emit_define_label();
+        m_comp->emit_load_fast(local.first);
+        m_comp->emit_branch(BranchFalse, unassigned);
+        m_comp->emit_load_fast(local.first);
+        m_comp->emit_guard_check(m_fastNativeLocalValueKinds[local.first]);
+        m_comp->emit_branch(BranchFalse, bail);
+        m_comp->emit_mark_label(unassigned);
+    }
+    auto& stackInfo = getStackInfo(target);
+    for (size_t i = 0; i < depth && i < stackInfo.size(); i++) {
+        if (stackInfo[i].hasValue() && stackInfo[i].Value->kind() == AVK_UnboxedRangeIterator) {
+            m_comp->emit_load_from_frame_value_stack(i);
+            m_comp->emit_guard_check(AVK_UnboxedRangeIterator);
+            m_comp->emit_branch(BranchFalse, bail);
+        }
+    }
+
+    // The frame keeps its references to the locals, unboxing consumes one
+    Local success = m_comp->emit_define_local(LK_Int);
+    for (auto& local : m_fastNativeLocals) {
+        auto unassigned = m_comp->emit_define_label();
+        m_comp->emit_load_fast(local.first);
+        m_comp->emit_branch(BranchFalse, unassigned);
+        m_comp->emit_load_fast(local.first);
+        m_comp->emit_dup();
+        m_comp->emit_incref();
+        m_comp->emit_unbox(m_fastNativeLocalValueKinds[local.first], false, success);
+        m_comp->emit_store_local(local.second);
+        m_comp->emit_mark_label(unassigned);
+    }
+    m_comp->emit_free_local(success);
+    // The value stack moves into the jitted code
+    for (size_t i = 0; i < depth; i++) {
+        m_comp->emit_load_from_frame_value_stack(i);
+    }
+    m_comp->emit_set_frame_stackdepth(0);
+    m_comp->emit_branch(BranchAlways, body);
+
+    m_comp->emit_mark_label(bail);
+    m_comp->emit_resume_in_interpreter();
+    m_comp->emit_store_local(retValue);
+    m_comp->emit_branch(BranchAlways, retLabel);
+}
+
+// Hands the frame to the interpreter at the end of the region, to run the rest of the function.
+void AbstractInterpreter::emitRegionExit(py_opindex regionEnd, Local retValue, Label retLabel) {
+    size_t depth = m_stack.size();
+    for (size_t i = 0; i < depth; i++) {
+        if (isUnboxedRangeIterator(regionEnd, i))
+            m_comp->emit_box_range_iterator();
+        m_comp->emit_store_in_frame_value_stack(depth - 1 - i);
+    }
+    storeFastNativeLocals();
+    m_comp->emit_leave_region(regionEnd, depth);
+    m_comp->emit_store_local(retValue);
+    m_comp->emit_branch(BranchAlways, retLabel);
+}
+
+void AbstractInterpreter::escapeEdges(ExceptionHandler* handler, const vector<Edge>& edges, py_opindex curByte, size_t blockDepth, Local retValue, Label retLabel) {
     // Check if edges need boxing/unboxing
     // If none of the edges need escaping, skip
     bool needsEscapes = false;
@@ -1341,6 +1787,11 @@ void AbstractInterpreter::escapeEdges(ExceptionHandler* handler, const vector<Ed
     if (!needsEscapes)
         return;
 
+    // Values that would fail to unbox send the frame back to the interpreter
+    // instead of raising, where the frame state allows it.
+    if (canDeoptimize(edges, curByte, blockDepth))
+        emitDeoptimizationGuards(edges, curByte, retValue, retLabel);
+
     // Escape edges
     Local escapeSuccess = m_comp->emit_define_local(LK_Int);
     Label noError = m_comp->emit_define_label();
@@ -1409,8 +1860,8 @@ AbstactInterpreterCompileWorkerResult AbstractInterpreter::compileWorker(PgcStat
     // or into a finally or exception handler.  Blocks are popped as we leave those protected regions.
     // When we pop a block associated with a try body we transform it into the correct block for the handler
     BlockStack m_blockStack;
-    m_raiseAndFreeLocals.clear();
-    m_raiseAndFree.clear();
+    m_pendingRaises.clear();
+    m_pendingRaiseSites.clear();
     m_stack.clear();
     offsetLabels yieldOffsets;
     m_comp->emit_lasti_init();
@@ -1424,28 +1875,81 @@ AbstactInterpreterCompileWorkerResult AbstractInterpreter::compileWorker(PgcStat
         FLAG_OPT_USAGE(InlineDecref);
     }
 
+    m_pendingMethodCalls = 0;
+    m_fastNativeLocals.clear();
+    m_fastNativeLocalKinds.clear();
+    m_fastNativeLocalValueKinds.clear();
     if (graph->isValid()) {
         for (auto& fastLocal : graph->getUnboxedFastLocals()) {
             m_fastNativeLocals[fastLocal.first] = m_comp->emit_define_local(fastLocal.second);
             m_fastNativeLocalKinds[fastLocal.first] = avkAsStackEntryKind(fastLocal.second);
+            m_fastNativeLocalValueKinds[fastLocal.first] = fastLocal.second;
         }
     }
 
-    if (mCode->co_flags & CO_GENERATOR) {
+    if (SUSPENDABLE(mCode)) {
         for (py_opindex curByte = 0; curByte < mSize; curByte += SIZEOF_CODEUNIT) {
             assert(curByte % SIZEOF_CODEUNIT == 0);
             auto op = graph->operator[](curByte);
-            if (op.opcode == YIELD_VALUE){
-                yieldOffsets[op.index] = m_comp->emit_define_label();
+            vector<py_opindex> resumePoints;
+            if (op.opcode == YIELD_VALUE)
+                resumePoints.push_back(op.index);
+            if (op.opcode == YIELD_FROM) {
+                // As in the interpreter, f_lasti is the instruction before while the sub-iterator is
+                // suspended, and the YIELD_FROM once gen.throw() has finished the sub-iterator.
+                resumePoints.push_back(op.index - SIZEOF_CODEUNIT);
+                resumePoints.push_back(op.index);
+            }
+            for (auto resumePoint : resumePoints) {
+                yieldOffsets[resumePoint] = m_comp->emit_define_label();
                 m_comp->emit_lasti();
-                m_comp->emit_int(op.index / 2);
-                m_comp->emit_branch(BranchEqual, yieldOffsets[op.index]);
+                m_comp->emit_int(resumePoint / 2);
+                m_comp->emit_branch(BranchEqual, yieldOffsets[resumePoint]);
             }
         }
     }
 
     m_comp->emit_init_instr_counter();
 
+    // On-stack replacement: probed code counts iterations at each loop header and moves a hot
+    // frame into the optimized variant, which has an entry point at the same loop headers.
+    bool osrSupported = g_pyjionSettings.osrThreshold > 0 && PyJit_PgcEnabled() &&
+                        !SUSPENDABLE(mCode) && !mTracingEnabled && !mProfilingEnabled &&
+                        !argumentsReassigned();
+    bool osrTransfers = osrSupported && pgc_status == Uncompiled;
+    bool osrEntries = osrSupported && pgc_status != Uncompiled;
+    unordered_set<py_opindex> loopHeaders;
+    unordered_map<py_opindex, size_t> osrEntryDepths;
+    Local osrCounter;
+    Label osrDispatch;
+    if (osrSupported) {
+        for (py_opindex curByte = 0; curByte < mSize; curByte += SIZEOF_CODEUNIT) {
+            auto op = graph->operator[](curByte);
+            switch (op.opcode) {
+                case JUMP_ABSOLUTE:
+                case POP_JUMP_IF_FALSE:
+                case POP_JUMP_IF_TRUE:
+                case JUMP_IF_FALSE_OR_POP:
+                case JUMP_IF_TRUE_OR_POP:
+                    if (op.jumpsTo <= op.index)
+                        loopHeaders.insert(op.jumpsTo);
+                    break;
+            }
+        }
+    }
+    if (osrTransfers) {
+        osrCounter = m_comp->emit_define_local(LK_NativeInt);
+        m_comp->emit_sizet(0);
+        m_comp->emit_store_local(osrCounter);
+    }
+    if (osrEntries) {
+        // A frame coming from probed code has f_lasti set, a new frame doesn't
+        osrDispatch = m_comp->emit_define_label();
+        m_comp->emit_lasti();
+        m_comp->emit_int(-1);
+        m_comp->emit_branch(BranchNotEqual, osrDispatch);
+    }
+
     if (mTracingEnabled) {
         // push initial trace on entry to frame
         m_comp->emit_trace_frame_entry();
@@ -1502,6 +2006,13 @@ AbstactInterpreterCompileWorkerResult AbstractInterpreter::compileWorker(PgcStat
             m_comp->emit_fetch_err();
         }
 
+        if (loopHeaders.find(curByte) != loopHeaders.end() && canReplaceOnStack(m_blockStack.size())) {
+            if (osrTransfers)
+                emitOsrTransfer(curByte, osrCounter, m_retValue, m_retLabel);
+            if (osrEntries)
+                osrEntryDepths[curByte] = m_stack.size();
+        }
+
         if (!canSkipLastiUpdate(op.opcode, (CAN_UNBOX() && op.escape))) {
             m_comp->emit_lasti_update(op.index); // TODO: See if it makes more sense to put this in branchRaise()
             if (mTracingEnabled)
@@ -1513,12 +2024,12 @@ AbstactInterpreterCompileWorkerResult AbstractInterpreter::compileWorker(PgcStat
         bool skipEffect = false;
 
         auto edges = graph->getEdges(curByte);
-        if (g_pyjionSettings.pgc && pgcProbeRequired(curByte, pgc_status) && !(CAN_UNBOX() && op.escape)) {
+        if (PyJit_PgcEnabled() && pgcProbeRequired(curByte, pgc_status) && !(CAN_UNBOX() && op.escape)) {
             emitPgcProbes(curByte, pgcProbeSize(curByte), edges);
         }
 
         if (CAN_UNBOX()) {
-            escapeEdges(CUR_HANDLER, edges, curByte);
+            escapeEdges(CUR_HANDLER, edges, curByte, m_blockStack.size(), m_retValue, m_retLabel);
         }
 
         switch (byte) {
@@ -1753,6 +2264,8 @@ AbstactInterpreterCompileWorkerResult AbstractInterpreter::compileWorker(PgcStat
                 m_comp->emit_load_global(PyTuple_GetItem(mCode->co_names, oparg), lastResolvedGlobal[oparg], mGlobalsVersion, mBuiltinsVersion);
                 errorCheck(CUR_HANDLER, "load global failed", PyUnicode_AsUTF8(PyTuple_GetItem(mCode->co_names, oparg)), op.index);
                 incStack();
+                if (!m_fastNativeLocals.empty() && mFrameGlobals.find(oparg) != mFrameGlobals.end())
+                    emitFrameGlobalFlush(oparg, curByte);
                 break;
             case LOAD_CONST:
                 if (CAN_UNBOX() && op.escape) {
@@ -2327,28 +2840,49 @@ AbstactInterpreterCompileWorkerResult AbstractInterpreter::compileWorker(PgcStat
                         break;
                 }
                 break;
-            case SETUP_FINALLY: {
-                auto handlerLabel = m_comp->emit_define_label();
-                auto newHandler = m_exceptionHandler.AddSetupFinallyHandler(
-                        handlerLabel,
-                        m_stack,
-                        CUR_HANDLER,
-                        op.jumpsTo);
-
-                auto newBlock = BlockInfo(
-                        op.jumpsTo,
-                        SETUP_FINALLY,
-                        newHandler);
-
-                m_blockStack.emplace_back(newBlock);
-                m_comp->emit_push_block(SETUP_FINALLY, op.jumpsTo, 0);
-
-                ValueStack newStack = ValueStack(m_stack);
-                newStack.inc(6, STACK_KIND_OBJECT);
-                // This stack only gets used if an error occurs within the try:
-                m_offsetStack[op.jumpsTo] = newStack;
+            case SETUP_FINALLY:
+                pushFinallyBlock(m_exceptionHandler, m_blockStack, m_offsetStack, op.jumpsTo);
                 skipEffect = true;
-            } break;
+                break;
+            case BEFORE_ASYNC_WITH:
+            case SETUP_WITH: {
+                // Replaces the context manager with its bound __exit__, the result of __enter__ is
+                // pushed once the block is set up.
+                Local enterResult = m_comp->emit_define_local(LK_Pointer);
+                if (byte == BEFORE_ASYNC_WITH) {
+                    m_comp->emit_before_async_with(enterResult);
+                } else if (OPT_ENABLED(LoadAttr) && !stackInfo.empty() && stackInfo.top().hasValue() && stackInfo.top().Value->known() &&
+                           m_comp->emit_setup_with(enterResult, stackInfo.top().Value->pythonType())) {
+                    FLAG_OPT_USAGE(LoadAttr);
+                } else {
+                    m_comp->emit_setup_with(enterResult);
+                }
+                decStack();
+                errorCheck(CUR_HANDLER, "failed to enter context manager", "", op.index);
+                incStack();
+                if (byte == SETUP_WITH)
+                    pushFinallyBlock(m_exceptionHandler, m_blockStack, m_offsetStack, op.jumpsTo);
+                m_comp->emit_load_and_free_local(enterResult);
+                incStack();
+                skipEffect = true;
+                break;
+            }
+            case SETUP_ASYNC_WITH: {
+                // The awaited result of __aenter__ goes back on the stack once the block is set up.
+                Local enterResult = m_comp->emit_define_local(LK_Pointer);
+                m_comp->emit_store_local(enterResult);
+                decStack();
+                pushFinallyBlock(m_exceptionHandler, m_blockStack, m_offsetStack, op.jumpsTo);
+                m_comp->emit_load_and_free_local(enterResult);
+                incStack();
+                skipEffect = true;
+                break;
+            }
+            case WITH_EXCEPT_START:
+                m_comp->emit_with_except_start();
+                errorCheck(CUR_HANDLER, "__exit__ failed", "", op.index);
+                incStack();
+                break;
             case RERAISE: {
                 m_comp->emit_restore_err();
                 // TODO: Both RERAISE and POP_EXCEPT are unreachable in some scenarios.
@@ -2357,6 +2891,13 @@ AbstactInterpreterCompileWorkerResult AbstractInterpreter::compileWorker(PgcStat
                     decStack(3);
                 else
                     skipEffect = true;
+                if (m_stack.size() >= 3 && m_blockStack.back().Kind == EXCEPT_HANDLER) {
+                    // Put back the exception which was being handled before this one, as the
+                    // interpreter does when it unwinds the handler block.
+                    m_comp->emit_pop_except();
+                    decStack(3);
+                    skipEffect = true;
+                }
                 branchRaise(CUR_HANDLER, "reraise error", "", op.index);
                 break;
             }
@@ -2375,10 +2916,94 @@ AbstactInterpreterCompileWorkerResult AbstractInterpreter::compileWorker(PgcStat
                 m_comp->emit_pop();// Dont do anything with the block atm
                 m_blockStack.pop_back();
                 break;
-            case SETUP_WITH:
-                return {nullptr, IncompatibleOpcode_With};
-            case YIELD_FROM:
-                return {nullptr, IncompatibleOpcode_Yield};
+            case YIELD_FROM: {
+                // Sends the value to the receiver until it returns, suspending this frame
+                // with the receiver on the value stack each time it yields.
+                auto send = m_comp->emit_define_label();
+                auto done = m_comp->emit_define_label();
+                auto resumed = m_comp->emit_define_label();
+                Local status = m_comp->emit_define_local(LK_Int);
+                m_comp->emit_mark_label(send);
+                m_comp->emit_send(status);
+                decStack();
+                errorCheck(CUR_HANDLER, "failed to send value", "", op.index);
+                incStack();
+                m_comp->emit_load_local(status);
+                m_comp->emit_int(PYGEN_NEXT);
+                m_comp->emit_branch(BranchNotEqual, done);
+                m_comp->emit_yield_value(m_retValue, m_retLabel, op.index - SIZEOF_CODEUNIT, m_stack.size(), yieldOffsets);
+                m_comp->emit_branch(BranchAlways, send);
+
+                m_comp->emit_mark_label(done);
+                m_comp->emit_rot_two();
+                m_comp->emit_pop_top();// receiver
+                decStack(2);
+                m_comp->emit_branch(BranchAlways, resumed);
+
+                // The value gen.throw() got back from the sub-iterator is on the frame's value stack
+                m_comp->emit_mark_label(yieldOffsets[op.index]);
+                for (uint32_t i = 0; i < m_stack.size() + 1; i++) {
+                    m_comp->emit_load_from_frame_value_stack(i);
+                }
+                m_comp->emit_dec_frame_stackdepth(m_stack.size() + 1);
+                m_comp->emit_mark_label(resumed);
+                m_comp->emit_free_local(status);
+                incStack();
+                break;
+            }
+            case GET_AWAITABLE:
+                m_comp->emit_get_awaitable();
+                decStack();
+                errorCheck(CUR_HANDLER, "object can't be awaited", "", op.index);
+                incStack();
+                break;
+            case GET_AITER:
+                m_comp->emit_get_aiter();
+                decStack();
+                errorCheck(CUR_HANDLER, "failed to get async iterator", "", op.index);
+                incStack();
+                break;
+            case GET_ANEXT:
+                m_comp->emit_get_anext();
+                errorCheck(CUR_HANDLER, "failed to get next awaitable", "", op.index);
+                incStack();
+                break;
+            case GET_YIELD_FROM_ITER:
+                m_comp->emit_get_yield_from_iter(mCode->co_flags & (CO_COROUTINE | CO_ITERABLE_COROUTINE));
+                decStack();
+                errorCheck(CUR_HANDLER, "failed to get iterator", "", op.index);
+                incStack();
+                break;
+            case END_ASYNC_FOR: {
+                // StopAsyncIteration ends the loop, anything else is raised again
+                auto reraise = m_comp->emit_define_label();
+                auto handlerStack = ValueStack(m_stack);
+                m_comp->emit_dup();
+                m_comp->emit_is_stop_async_iteration();
+                m_comp->emit_branch(BranchFalse, reraise);
+                for (int i = 0; i < 3; i++) {
+                    m_comp->emit_pop_top();
+                }
+                decStack(3);
+                auto block = m_blockStack.back();
+                unwindEh(block.CurrentHandler, block.CurrentHandler->BackHandler);
+                m_comp->emit_pop_except();
+                decStack(3);
+                m_comp->emit_pop_top();// async iterator
+                decStack();
+                auto loopDone = m_comp->emit_define_label();
+                m_comp->emit_branch(BranchAlways, loopDone);
+
+                auto loopStack = ValueStack(m_stack);
+                m_stack = handlerStack;
+                m_comp->emit_mark_label(reraise);
+                m_comp->emit_restore_err();
+                decStack(3);
+                branchRaise(CUR_HANDLER, "async for failed", "", op.index);
+                m_stack = loopStack;
+                m_comp->emit_mark_label(loopDone);
+                break;
+            }
             case IMPORT_NAME:
                 m_comp->emit_import_name(PyTuple_GetItem(mCode->co_names, oparg));
                 decStack(2);
@@ -2557,9 +3182,12 @@ AbstactInterpreterCompileWorkerResult AbstractInterpreter::compileWorker(PgcStat
                 }
                 incStack(1);
                 intErrorCheck(CUR_HANDLER, "failed to load method", PyUnicode_AsUTF8(PyTuple_GetItem(mCode->co_names, oparg)), op.index);
+                m_pendingMethodCalls++;
                 break;
             }
             case CALL_METHOD: {
+                if (m_pendingMethodCalls > 0)
+                    m_pendingMethodCalls--;
                 if (!m_comp->emit_method_call(oparg)) {
                     buildTuple(CUR_HANDLER, oparg);
                     m_comp->emit_method_call_n();
@@ -2597,6 +3225,18 @@ AbstactInterpreterCompileWorkerResult AbstractInterpreter::compileWorker(PgcStat
         }
     }
 
+    if (mRegion) {
+        // The region ends where the interpreter can take over, anything else leaves it uncompiled
+        offsets.mark(mSize);
+        auto regionEndStack = m_offsetStack.find(mSize);
+        if (regionEndStack != m_offsetStack.end()) {
+            m_stack = ValueStack(regionEndStack->second);
+        }
+        if (mTracingEnabled || mProfilingEnabled || !canReplaceOnStack(m_blockStack.size()))
+            return {nullptr, IncompatibleSize};
+        emitRegionExit(mSize, m_retValue, m_retLabel);
+    }
+
     // label branch for error handling when we have no EH handlers, (return NULL).
     m_comp->emit_branch(BranchAlways, rootHandlerLabel);
     m_comp->emit_mark_label(rootHandlerLabel);
@@ -2608,6 +3248,25 @@ AbstactInterpreterCompileWorkerResult AbstractInterpreter::compileWorker(PgcStat
     auto finalRet = m_comp->emit_define_label();
     m_comp->emit_branch(BranchAlways, finalRet);
 
+    if (osrEntries) {
+        unordered_map<py_opindex, Label> entryLabels;
+        m_comp->emit_mark_label(osrDispatch);
+        for (auto& entry : osrEntryDepths) {
+            entryLabels[entry.first] = m_comp->emit_define_label();
+            m_comp->emit_lasti();
+            m_comp->emit_int((int32_t) (entry.first / 2) - 1);
+            m_comp->emit_branch(BranchEqual, entryLabels[entry.first]);
+        }
+        // No entry point here (e.g. a different set of loops qualified in the probed code)
+        m_comp->emit_resume_in_interpreter();
+        m_comp->emit_store_local(m_retValue);
+        m_comp->emit_branch(BranchAlways, m_retLabel);
+        for (auto& entry : osrEntryDepths) {
+            m_comp->emit_mark_label(entryLabels[entry.first]);
+            emitOsrEntry(entry.first, entry.second, offsets.get(entry.first), m_retValue, m_retLabel);
+        }
+    }
+
     // Return value from local
     m_comp->emit_mark_label(m_retLabel);
     m_comp->emit_load_local(m_retValue);
@@ -2627,12 +3286,14 @@ AbstactInterpreterCompileWorkerResult AbstractInterpreter::compileWorker(PgcStat
     }
 
     m_comp->emit_ret();
+    emitPendingRaises();
     auto code = m_comp->emit_compile();
     if (code != nullptr) {
         return {
                 .compiledCode = code,
                 .result = Success,
                 .optimizations = optimizationsMade,
+                .osrEntries = osrEntries,
         };
     } else {
         return {nullptr, CompilationJitFailure};
@@ -2653,21 +3314,25 @@ InstructionGraph* AbstractInterpreter::buildInstructionGraph(bool escapeLocals)
     return new InstructionGraph(mCode, stacks, escapeLocals);
 }
 
-AbstactInterpreterCompileResult AbstractInterpreter::compile(PyObject* builtins, PyObject* globals, PyjionCodeProfile* profile, PgcStatus pgc_status) {
+AbstactInterpreterCompileResult AbstractInterpreter::compile(PyObject* builtins, PyObject* globals, PyjionCodeProfile* profile, PgcStatus pgc_status, bool withGeneric) {
     try {
 
         AbstractInterpreterResult interpreted = interpret(builtins, globals, profile, pgc_status);
         if (interpreted != Success) {
             return {nullptr, nullptr, interpreted};
         }
-        bool unboxVars = OPT_ENABLED(Unboxing) && !(mCode->co_flags & CO_GENERATOR);
+        bool unboxVars = OPT_ENABLED(Unboxing) && !SUSPENDABLE(mCode);
+        bool eagerGeneric = withGeneric && !g_pyjionSettings.lazyGeneric;
         auto boxedGraph = buildInstructionGraph(unboxVars);
-        PythonCompiler jitter(mCode);
+        PythonCompiler jitter(mCode, mBaseline);
+        // RyuJIT compiles the specialized variant on the JIT pool while the generic variant is emitted and compiled here
+        bool parallel = eagerGeneric && jitter.compile_in_background();
         auto workerResult = compileWorker(pgc_status, boxedGraph, &jitter);
         if (workerResult.result != Success){
             return {nullptr, nullptr, workerResult.result};
         }
-        AbstactInterpreterCompileResult result = {workerResult.compiledCode, nullptr, Success, nullptr, nullptr, workerResult.optimizations};
+        AbstactInterpreterCompileResult result = {nullptr, nullptr, Success, nullptr, nullptr, workerResult.optimizations};
+        result.osrEntries = workerResult.osrEntries;
         if (g_pyjionSettings.graph) {
             result.instructionGraph = boxedGraph->makeGraph(PyUnicode_AsUTF8(mCode->co_name));
 
@@ -2680,17 +3345,26 @@ AbstactInterpreterCompileResult AbstractInterpreter::compile(PyObject* builtins,
             printf("%s", PyUnicode_AsUTF8(result.instructionGraph));
 #endif
         }
-        auto genericGraph = buildInstructionGraph(false);
-        PythonCompiler unboxedJitter(mCode);
-        auto genericResult = compileWorker(Optimized, genericGraph, &unboxedJitter);
-        if (genericResult.result == Success){
-            if (g_pyjionSettings.graph) {
-                result.genericGraph = genericGraph->makeGraph(PyUnicode_AsUTF8(mCode->co_name));
+        // When the generic variant is lazy it's only compiled once a call misses the specialization.
+        if (eagerGeneric) {
+            auto genericGraph = buildInstructionGraph(false);
+            PythonCompiler unboxedJitter(mCode, mBaseline);
+            auto genericResult = compileWorker(Optimized, genericGraph, &unboxedJitter);
+            if (genericResult.result == Success) {
+                if (g_pyjionSettings.graph) {
+                    result.genericGraph = genericGraph->makeGraph(PyUnicode_AsUTF8(mCode->co_name));
+                }
+                result.genericCompiledCode = genericResult.compiledCode;
             }
-            result.genericCompiledCode = genericResult.compiledCode;
+            delete genericGraph;
         }
-        delete genericGraph;
         delete boxedGraph;
+        result.compiledCode = parallel ? jitter.join_compile() : workerResult.compiledCode;
+        if (result.compiledCode == nullptr) {
+            Py_XDECREF(result.instructionGraph);
+            Py_XDECREF(result.genericGraph);
+            return {nullptr, nullptr, CompilationJitFailure};
+        }
         return result;
     } catch (const exception& e) {
 #ifdef DEBUG_VERBOSE
@@ -2700,6 +3374,34 @@ AbstactInterpreterCompileResult AbstractInterpreter::compile(PyObject* builtins,
     }
 }
 
+AbstactInterpreterCompileResult AbstractInterpreter::compileGeneric(PyObject* builtins, PyObject* globals, PyjionCodeProfile* profile) {
+    try {
+        // No argument types or profile data are applied, so the result is valid for any call.
+        AbstractInterpreterResult interpreted = interpret(builtins, globals, profile, Optimized);
+        if (interpreted != Success) {
+            return {nullptr, nullptr, interpreted};
+        }
+        auto genericGraph = buildInstructionGraph(false);
+        PythonCompiler genericJitter(mCode);
+        auto genericResult = compileWorker(Optimized, genericGraph, &genericJitter);
+        if (genericResult.result != Success) {
+            delete genericGraph;
+            return {nullptr, nullptr, genericResult.result};
+        }
+        AbstactInterpreterCompileResult result = {nullptr, genericResult.compiledCode, Success, nullptr, nullptr, genericResult.optimizations};
+        if (g_pyjionSettings.graph) {
+            result.genericGraph = genericGraph->makeGraph(PyUnicode_AsUTF8(mCode->co_name));
+        }
+        delete genericGraph;
+        return result;
+    } catch (const exception& e) {
+#ifdef DEBUG_VERBOSE
+        printf("Error whilst compiling generic variant of %s: %s\n", PyUnicode_AsUTF8(mCode->co_name), e.what());
+#endif
+        return {nullptr, nullptr, CompilationException, };
+    }
+}
+
 bool AbstractInterpreter::canSkipLastiUpdate(py_opcode opcode, bool unboxed) {
     switch (opcode) {
         case COMPARE_OP:
@@ -2874,3 +3576,7 @@ void AbstractInterpreter::enableProfiling() {
 void AbstractInterpreter::disableProfiling() {
     mProfilingEnabled = false;
 }
+
+void AbstractInterpreter::enableBaseline() {
+    mBaseline = true;
+}
@@ -237,6 +237,44 @@ enum AbstractInterpreterResult {
     IncompatibleOpcode_With = 104,
     IncompatibleOpcode_Unknown = 110,
     IncompatibleFrameGlobal = 120,
+
+    // Cost model codes
+    NotProfitable_RunOnce = 130,// Module or class body without loops
+    NotProfitable_Calls = 131,  // Dominated by calls Pyjion can't speed up
+
+    // Policy codes
+    Excluded = 140,// @pyjion.nojit or an excluded module
+};
+
+// What the error check leaves on the stack when it branches to the raise path
+enum RaiseResult {
+    RaiseNoResult,    // The checked value was consumed by the branch
+    RaiseObjectResult,// The null object
+    RaiseIntResult,   // The int error code
+};
+
+// A branch to the error handler, emitted after the body of the method so that the
+// non-raising path only has the test and branch.
+struct PendingRaise {
+    Label target;
+    ExceptionHandler* handler;
+    ValueStack stack;// The stack at the branch, without the result being checked
+    RaiseResult result;
+    bool force;
+    bool trace;
+    const char* reason;
+    const char* context;
+    py_opindex curByte;
+};
+
+// A branch which shares a raise path, with DEBUG_VERBOSE it reports its own reason
+// before joining the shared path.
+struct PendingRaiseSite {
+    Label target;
+    Label raise;
+    const char* reason;
+    const char* context;
+    py_opindex curByte;
 };
 
 struct AbstractInterpreterPreprocessResult {
@@ -247,6 +285,7 @@ struct AbstactInterpreterCompileWorkerResult {
     JittedCode* compiledCode = nullptr;
     AbstractInterpreterResult result = NoResult;
     OptimizationFlags optimizations = OptimizationFlags();
+    bool osrEntries = false;
 };
 
 struct AbstactInterpreterCompileResult {
@@ -256,6 +295,7 @@ struct AbstactInterpreterCompileResult {
     PyObject* instructionGraph = nullptr;
     PyObject* genericGraph = nullptr;
     OptimizationFlags optimizations = OptimizationFlags();
+    bool osrEntries = false;// The compiled code can pick up frames moved over from probed code
 };
 
 class StackImbalanceException : public std::exception {
@@ -299,9 +339,11 @@ class AbstractInterpreter : public PyjionBase {
     PyCodeObject* mCode;
     _Py_CODEUNIT* mByteCode;// Used by macros
     size_t mSize;
+    bool mRegion;// Only [0, mSize) is compiled, the interpreter runs the rest of the function
     Local mErrorCheckLocal;
     bool mTracingEnabled;
     bool mProfilingEnabled;
+    bool mBaseline;
     Local mTracingLastInstr;
     uint64_t mGlobalsVersion;
     uint64_t mBuiltinsVersion;
@@ -316,6 +358,9 @@ class AbstractInterpreter : public PyjionBase {
     vector<AbstractSource*> m_sources;
     unordered_map<py_oparg, Local> m_fastNativeLocals;
     unordered_map<py_oparg, StackEntryKind> m_fastNativeLocalKinds;
+    unordered_map<py_oparg, AbstractValueKind> m_fastNativeLocalValueKinds;
+    // Number of LOAD_METHOD results on the stack still waiting for their CALL_METHOD
+    size_t m_pendingMethodCalls = 0;
     IPythonCompiler* m_comp;
 
     // Tracks the current depth of the stack,  as well as if we have an object reference that needs to be freed.
@@ -324,16 +369,13 @@ class AbstractInterpreter : public PyjionBase {
 
     unordered_map<py_oparg, Py_ssize_t> nameHashes;
     unordered_map<py_oparg, PyObject*> lastResolvedGlobal;
+    // Names of builtins which read the frame's locals (vars, dir, locals, eval, exec) and the builtin they resolved to
+    unordered_map<py_oparg, PyObject*> mFrameGlobals;
 
-    // Set of labels used for when we need to raise an error but have values on the stack
-    // that need to be freed.  We have one set of labels which fall through to each other
-    // before doing the raise:
-    //      free2: <decref>/<pop>
-    //      free1: <decref>/<pop>
-    //      raise logic.
-    //  This was so we don't need to have decref/frees spread all over the code
-    vector<vector<Label>> m_raiseAndFree;
-    vector<Local> m_raiseAndFreeLocals;
+    // Raise paths for the error checks, shared between checks with the same handler and stack
+    // so the error handling doesn't have to be spread all over the code
+    vector<PendingRaise> m_pendingRaises;
+    vector<PendingRaiseSite> m_pendingRaiseSites;
 
     unordered_map<py_opindex, bool> m_assignmentState;
 
@@ -343,7 +385,9 @@ public:
     explicit AbstractInterpreter(PyCodeObject* code);
     ~AbstractInterpreter();
 
-    AbstactInterpreterCompileResult compile(PyObject* builtins, PyObject* globals, PyjionCodeProfile* profile, PgcStatus pgc_status);
+    AbstactInterpreterCompileResult compile(PyObject* builtins, PyObject* globals, PyjionCodeProfile* profile, PgcStatus pgc_status, bool withGeneric = true);
+    // Compiles only the generic (boxed, unspecialized) variant, used when the variant is built lazily.
+    AbstactInterpreterCompileResult compileGeneric(PyObject* builtins, PyObject* globals, PyjionCodeProfile* profile);
     AbstractInterpreterResult interpret(PyObject* builtins, PyObject* globals, PyjionCodeProfile* profile, PgcStatus status);
 
     void setLocalType(size_t index, PyObject* val);
@@ -360,6 +404,7 @@ public:
     void disableTracing();
     void enableProfiling();
     void disableProfiling();
+    void enableBaseline();
     InstructionGraph* buildInstructionGraph(bool escapeLocals);
 
 private:
@@ -368,7 +413,7 @@ private:
     static bool mergeStates(InterpreterState& newState, InterpreterState& mergeTo);
     bool updateStartState(InterpreterState& newState, py_opindex index);
     void initStartingState();
-    AbstractInterpreterPreprocessResult preprocess();
+    AbstractInterpreterPreprocessResult preprocess(PyjionCodeProfile* profile);
     AbstractSource* newSource(AbstractSource* source) {
         m_sources.emplace_back(source);
         return source;
@@ -391,6 +436,8 @@ private:
     void intErrorCheck(ExceptionHandler* handler, const char* reason = nullptr, const char* context = "", py_opindex curByte = 0);
     void branchRaise(ExceptionHandler* handler, const char* reason = nullptr, const char* context = "", py_opindex curByte = 0, bool force = false, bool trace = true);
     void raiseOnNegativeOne(ExceptionHandler* handler, py_opindex curByte);
+    Label raiseLabel(ExceptionHandler* handler, RaiseResult result, const char* reason, const char* context, py_opindex curByte, bool force = false, bool trace = true);
+    void emitPendingRaises();
     void unwindEh(ExceptionHandler* fromHandler, ExceptionHandler* toHandler = nullptr);
     void decStack(size_t size = 1);
     void incStack(size_t size = 1, StackEntryKind kind = STACK_KIND_OBJECT);
@@ -402,7 +449,19 @@ private:
     void loadFastUnboxed(py_oparg local, py_opindex opcodeIndex);
     void loadFastWorker(ExceptionHandler*, py_oparg local, bool checkUnbound, py_opindex curByte);
     void testBoolAndBranch(Local value, bool isTrue, Label target);
-    void escapeEdges(ExceptionHandler*, const vector<Edge>& edges, py_opindex curByte);
+    void escapeEdges(ExceptionHandler*, const vector<Edge>& edges, py_opindex curByte, size_t blockDepth, Local retValue, Label retLabel);
+    bool canDeoptimize(const vector<Edge>& edges, py_opindex curByte, size_t blockDepth);
+    void emitDeoptimizationGuards(const vector<Edge>& edges, py_opindex curByte, Local retValue, Label retLabel);
+    bool isUnboxedRangeIterator(py_opindex curByte, size_t stackIndex);
+    void pushFinallyBlock(ExceptionHandlerManager& handlers, BlockStack& blockStack, unordered_map<py_opindex, ValueStack>& offsetStack, py_opindex handlerIndex);
+    void storeFastNativeLocals();
+    void emitFrameGlobalFlush(py_oparg nameIndex, py_opindex curByte);
+    bool argumentsReassigned();
+    bool canReplaceOnStack(size_t blockDepth);
+    void emitOsrTransfer(py_opindex curByte, Local counter, Local retValue, Label retLabel);
+    void emitOsrEntry(py_opindex target, size_t depth, Label body, Local retValue, Label retLabel);
+    py_opindex findRegionEnd();
+    void emitRegionExit(py_opindex regionEnd, Local retValue, Label retLabel);
 };
 bool canReturnInfinity(py_opcode opcode);
 
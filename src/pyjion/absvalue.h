@@ -84,7 +84,7 @@ enum AbstractValueKind {
     AVK_Staticmethod = 33,
     AVK_Super = 34,
     AVK_Zip = 35,
-    AVK_UnboxedRangeIterator = 36,
+    AVK_UnboxedRangeIterator = 36,// Keep last, saved profiles are checked against it
 };
 
 static bool isKnownType(AbstractValueKind kind) {
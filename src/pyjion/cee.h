@@ -85,12 +85,12 @@ public:
     }
 
     void* allocateMemory(size_t size) override {
-        // Use CPython's memory allocator (alignment 16)
-        return PyMem_Malloc(size);
+        // Use CPython's raw memory allocator (alignment 16), RyuJIT runs without the GIL
+        return PyMem_RawMalloc(size);
     }
 
     void freeMemory(void* block) override {
-        return PyMem_Free(block);
+        return PyMem_RawFree(block);
     }
 
     int getIntConfigValue(const WCHAR* name, int defaultValue) override {
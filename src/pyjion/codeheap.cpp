@@ -0,0 +1,338 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#include "codeheap.h"
+
+#ifdef WINDOWS
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(__APPLE__) && defined(__aarch64__) && defined(MAP_JIT)
+// Code is made writable per thread with pthread_jit_write_protect_np() while it's compiled, so
+// threads running the code never see it writable and no pages need to be sealed.
+#define CODE_HEAP_THREAD_WRITE_PROTECT
+#endif
+
+CodeHeap g_codeHeap;
+
+static long currentProcess() {
+#ifdef WINDOWS
+    return (long) GetCurrentProcessId();
+#else
+    return (long) getpid();
+#endif
+}
+
+static size_t sizeClass(size_t bytes) {
+    size_t granules = bytes / CodeHeap::Granule;
+    size_t sizeClass = 0;
+    while (granules > 1 && sizeClass < CodeHeap::SizeClasses - 1) {
+        granules >>= 1;
+        sizeClass++;
+    }
+    return sizeClass;
+}
+
+CodeHeap::CodeHeap() {
+#ifdef WINDOWS
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    m_pageSize = systemInfo.dwPageSize;
+#else
+    m_pageSize = (size_t) sysconf(_SC_PAGESIZE);
+#endif
+}
+
+bool CodeHeap::map(Chunk& chunk) {
+#ifdef WINDOWS
+    chunk.rx = chunk.rw = (uint8_t*) VirtualAlloc(nullptr, chunk.size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    m_dualMapping = 0;
+    return chunk.rx != nullptr;
+#else
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+    if (m_dualMapping != 0) {
+        int fd = memfd_create("pyjion-code", MFD_CLOEXEC);
+        if (fd != -1) {
+            void* rw = MAP_FAILED;
+            void* rx = MAP_FAILED;
+            if (ftruncate(fd, (off_t) chunk.size) == 0) {
+                rw = mmap(nullptr, chunk.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (rw != MAP_FAILED)
+                    rx = mmap(nullptr, chunk.size, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+            }
+            close(fd);
+            if (rx != MAP_FAILED) {
+                chunk.rx = (uint8_t*) rx;
+                chunk.rw = (uint8_t*) rw;
+                m_dualMapping = 1;
+                return true;
+            }
+            if (rw != MAP_FAILED)
+                munmap(rw, chunk.size);
+        }
+        // Executable shared mappings can be refused (e.g. by SELinux), so stop trying after the first failure
+        if (m_dualMapping == 1)
+            return false;
+    }
+#endif
+#if defined(__APPLE__) && defined(MAP_JIT)
+    const int mode = MAP_PRIVATE | MAP_ANONYMOUS | MAP_JIT;
+#elif defined(MAP_ANONYMOUS)
+    const int mode = MAP_PRIVATE | MAP_ANONYMOUS;
+#elif defined(MAP_ANON)
+    const int mode = MAP_PRIVATE | MAP_ANON;
+#else
+#error "not supported"
+#endif
+#ifdef CODE_HEAP_THREAD_WRITE_PROTECT
+    const int protection = PROT_READ | PROT_WRITE | PROT_EXEC;
+#else
+    const int protection = PROT_READ | PROT_WRITE;
+#endif
+    m_dualMapping = 0;
+    void* addr = mmap(nullptr, chunk.size, protection, mode, -1, 0);
+    if (addr == MAP_FAILED)
+        return false;
+    chunk.rx = chunk.rw = (uint8_t*) addr;
+    return true;
+#endif
+}
+
+void CodeHeap::unmap(Chunk& chunk) {
+#ifdef WINDOWS
+    VirtualFree(chunk.rx, 0, MEM_RELEASE);
+#else
+    if (chunk.rw != chunk.rx)
+        munmap(chunk.rw, chunk.size);
+    munmap(chunk.rx, chunk.size);
+#endif
+}
+
+// Without a second view the pages of a block are flipped between read-write and read-execute.
+bool CodeHeap::sealsPages() const {
+#ifdef CODE_HEAP_THREAD_WRITE_PROTECT
+    return false;
+#else
+    return m_dualMapping == 0;
+#endif
+}
+
+bool CodeHeap::protect(const Block& block, bool executable) {
+#ifdef WINDOWS
+    DWORD previous;
+    return VirtualProtect(block.rx, block.size, executable ? PAGE_EXECUTE_READ : PAGE_READWRITE, &previous) != 0;
+#else
+    return mprotect(block.rx, block.size, executable ? PROT_READ | PROT_EXEC : PROT_READ | PROT_WRITE) == 0;
+#endif
+}
+
+bool CodeHeap::newChunk() {
+    Chunk chunk = {nullptr, nullptr, ChunkSize, 0, false, false};
+    if (!map(chunk))
+        return false;
+    // The end of the last chunk is still good for smaller methods
+    if (m_current != nullptr && m_cursor < m_current->size)
+        addFree({m_current->rx + m_cursor, m_current->rw + m_cursor, m_current->size - m_cursor}, *m_current);
+    m_current = &(m_chunks[chunk.rx] = chunk);
+    m_cursor = 0;
+    m_reserved += chunk.size;
+    return true;
+}
+
+CodeHeap::Chunk* CodeHeap::chunkOf(uint8_t* rx) {
+    auto chunk = m_chunks.upper_bound(rx);
+    if (chunk == m_chunks.begin())
+        return nullptr;
+    --chunk;
+    if (rx >= chunk->second.rx + chunk->second.size)
+        return nullptr;
+    return &chunk->second;
+}
+
+// Best fit: the smallest free block which is big enough, from the size class of the request or the
+// first larger class with a block in it. Whatever is left over is split off and stays free.
+bool CodeHeap::takeFree(size_t bytes, Block& block) {
+    for (size_t index = sizeClass(bytes); index < SizeClasses; index++) {
+        auto fit = m_sizeClasses[index].lower_bound({bytes, nullptr});
+        if (fit == m_sizeClasses[index].end())
+            continue;
+        block = m_free[fit->second];
+        removeFree(block);
+        if (block.size > bytes) {
+            addFree({block.rx + bytes, block.rw + bytes, block.size - bytes}, *chunkOf(block.rx));
+            block.size = bytes;
+        }
+        return true;
+    }
+    return false;
+}
+
+// Freed memory is merged with the free blocks either side of it in the same chunk, and memory at
+// the end of the chunk being filled goes back to it.
+void CodeHeap::addFree(Block block, Chunk& chunk) {
+    auto next = m_free.find(block.rx + block.size);
+    if (next != m_free.end() && next->first < chunk.rx + chunk.size) {
+        Block merged = next->second;
+        removeFree(merged);
+        block.size += merged.size;
+    }
+    auto previous = m_free.lower_bound(block.rx);
+    if (previous != m_free.begin()) {
+        --previous;
+        if (previous->first >= chunk.rx && previous->first + previous->second.size == block.rx) {
+            Block merged = previous->second;
+            removeFree(merged);
+            block = {merged.rx, merged.rw, merged.size + block.size};
+        }
+    }
+    if (&chunk == m_current && block.rx + block.size == m_current->rx + m_cursor) {
+        m_cursor -= block.size;
+        return;
+    }
+    m_free[block.rx] = block;
+    m_sizeClasses[sizeClass(block.size)].insert({block.size, block.rx});
+    m_freeBytes += block.size;
+}
+
+void CodeHeap::removeFree(const Block& block) {
+    m_sizeClasses[sizeClass(block.size)].erase({block.size, block.rx});
+    m_free.erase(block.rx);
+    m_freeBytes -= block.size;
+}
+
+// Private mappings are copied on write, so only chunks with a shared second view are frozen. Their
+// free memory is dropped and blocks released later aren't reused, a chunk is unmapped (in this
+// process only) once nothing in it is live.
+void CodeHeap::freezeChunks() {
+    if (m_dualMapping != 1)
+        return;
+    for (auto& chunk : m_chunks) {
+        if (!chunk.second.large)
+            chunk.second.frozen = true;
+    }
+    m_free.clear();
+    for (auto& blocks : m_sizeClasses)
+        blocks.clear();
+    m_freeBytes = 0;
+    m_current = nullptr;
+    m_cursor = 0;
+}
+
+void CodeHeap::checkOwner() {
+    long process = currentProcess();
+    if (process == m_owner)
+        return;
+    // A child forked without freeze() (e.g. from C) at least leaves the shared chunks to its parent
+    if (m_owner != 0)
+        freezeChunks();
+    m_owner = process;
+}
+
+CodeHeap::Block CodeHeap::allocate(size_t size) {
+    std::lock_guard<std::mutex> guard(m_lock);
+    checkOwner();
+    // The granule depends on how the chunks are mapped
+    if (m_dualMapping == -1 && !newChunk())
+        return {nullptr, nullptr, 0};
+    size_t granule = sealsPages() ? m_pageSize : Granule;
+    size_t bytes = size == 0 ? granule : (size + granule - 1) / granule * granule;
+
+    if (bytes > ChunkSize / 4) {
+        Chunk chunk = {nullptr, nullptr, (bytes + m_pageSize - 1) & ~(m_pageSize - 1), 0, true, false};
+        if (!map(chunk))
+            return {nullptr, nullptr, 0};
+        chunk.live = chunk.size;
+        m_chunks[chunk.rx] = chunk;
+        m_reserved += chunk.size;
+        m_used += chunk.size;
+        return {chunk.rx, chunk.rw, chunk.size};
+    }
+
+    Block block;
+    if (takeFree(bytes, block)) {
+        auto chunk = chunkOf(block.rx);
+        // Pages which were sealed for an earlier method are made writable again
+        if (sealsPages() && !protect(block, false)) {
+            addFree(block, *chunk);
+            return {nullptr, nullptr, 0};
+        }
+        chunk->live += bytes;
+    } else {
+        if ((m_current == nullptr || m_cursor + bytes > m_current->size) && !newChunk())
+            return {nullptr, nullptr, 0};
+        block = {m_current->rx + m_cursor, m_current->rw + m_cursor, bytes};
+        m_cursor += bytes;
+        m_current->live += bytes;
+    }
+    m_used += bytes;
+    return block;
+}
+
+bool CodeHeap::seal(const Block& block) {
+    if (block.rx == nullptr || !sealsPages())
+        return true;
+    return protect(block, true);
+}
+
+void CodeHeap::release(const Block& block) {
+    if (block.rx == nullptr)
+        return;
+    std::lock_guard<std::mutex> guard(m_lock);
+    checkOwner();
+    auto chunk = chunkOf(block.rx);
+    if (chunk == nullptr)
+        return;
+    m_used -= block.size;
+    chunk->live -= block.size;
+    if (chunk->large || (chunk->frozen && chunk->live == 0)) {
+        // Unmapping a shared chunk leaves it mapped in the other processes
+        m_reserved -= chunk->size;
+        uint8_t* rx = chunk->rx;
+        unmap(*chunk);
+        m_chunks.erase(rx);
+    } else if (!chunk->frozen) {
+        addFree(block, *chunk);
+    }
+}
+
+void CodeHeap::freeze() {
+    std::lock_guard<std::mutex> guard(m_lock);
+    freezeChunks();
+}
+
+CodeHeap::Statistics CodeHeap::statistics() {
+    std::lock_guard<std::mutex> guard(m_lock);
+    Statistics stats = {m_reserved, m_used, m_freeBytes, 0, 0, m_dualMapping == 1};
+    for (auto& chunk : m_chunks) {
+        if (chunk.second.large)
+            stats.largeBlocks++;
+        else
+            stats.chunks++;
+    }
+    return stats;
+}
@@ -0,0 +1,123 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#ifndef PYJION_CODEHEAP_H
+#define PYJION_CODEHEAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <utility>
+
+/* Executable memory shared by all compiled methods. Methods are bump allocated from large chunks
+ * in 64-byte granules, so small methods don't each take a page (and a mapping) of their own.
+ * Freed blocks are merged with free neighbours and kept in power-of-two size classes, a method
+ * takes the best fitting free block from its class or a larger one and the rest is split off.
+ * Methods bigger than a quarter of a chunk get a mapping of their own.
+ *
+ * Where the platform allows it a chunk is mapped twice, the compiler writes through the
+ * read-write view and the code runs from the read-execute view, so no page is ever writable and
+ * executable. Elsewhere chunks are mapped read-write and seal() flips a method's pages to
+ * read-execute once it's written. Blocks are rounded up to whole pages in that case, so sealing
+ * a method never affects one which is still being written.
+ *
+ * Shared chunks stay shared with forked children, freeze() is called before a fork so neither
+ * process writes to them again.
+ *
+ * Called without the GIL, all methods are thread-safe. */
+class CodeHeap {
+public:
+    struct Block {
+        uint8_t* rx;// Address the code runs from
+        uint8_t* rw;// Address the code is written through, the same as rx without a second view
+        size_t size;
+    };
+
+    struct Statistics {
+        size_t reserved;  // Bytes mapped for code
+        size_t used;      // Bytes in live blocks
+        size_t free;      // Bytes in freed blocks waiting to be reused
+        size_t chunks;    // Chunks shared between methods
+        size_t largeBlocks;// Methods with a mapping of their own
+        bool dualMapped;  // Code is written through a separate read-write view
+    };
+
+    static const size_t Granule = 64;
+    static const size_t ChunkSize = 1024 * 1024;
+    static const size_t SizeClasses = 15;// Up to ChunkSize / Granule granules
+
+    CodeHeap();
+
+    // Returns a writable block of at least size bytes aligned to Granule, or a block with
+    // rx == nullptr if the memory couldn't be mapped.
+    Block allocate(size_t size);
+    // Makes the block executable once the code has been written, returns false if it couldn't be.
+    bool seal(const Block& block);
+    void release(const Block& block);
+    // Stops reusing the memory in shared chunks, called before a fork.
+    void freeze();
+    Statistics statistics();
+
+private:
+    struct Chunk {
+        uint8_t* rx;
+        uint8_t* rw;
+        size_t size;
+        size_t live;// Bytes in live blocks
+        bool large;
+        bool frozen;// Shared with another process, never written again
+    };
+
+    std::mutex m_lock;
+    std::map<uint8_t*, Chunk> m_chunks;// By rx address
+    std::map<uint8_t*, Block> m_free;// By rx address, to find the neighbours of a freed block
+    std::set<std::pair<size_t, uint8_t*>> m_sizeClasses[SizeClasses];// Free blocks by size
+    Chunk* m_current = nullptr;
+    size_t m_cursor = 0;
+    long m_owner = 0;
+    size_t m_pageSize;
+    size_t m_reserved = 0;
+    size_t m_used = 0;
+    size_t m_freeBytes = 0;
+    int m_dualMapping = -1;// Unknown until the first chunk is mapped
+
+    bool map(Chunk& chunk);
+    void unmap(Chunk& chunk);
+    bool sealsPages() const;
+    bool protect(const Block& block, bool executable);
+    bool newChunk();
+    Chunk* chunkOf(uint8_t* rx);
+    bool takeFree(size_t bytes, Block& block);
+    void addFree(Block block, Chunk& chunk);
+    void removeFree(const Block& block);
+    void freezeChunks();
+    void checkOwner();
+};
+
+extern CodeHeap g_codeHeap;
+
+#endif//PYJION_CODEHEAP_H
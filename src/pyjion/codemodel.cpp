@@ -29,10 +29,11 @@
 #include <utility>
 
 int BaseModule::AddMethod(CorInfoType returnType, std::vector<Parameter> params, void* addr, const char* label) {
+    std::lock_guard<std::mutex> guard(m_lock);
     if (existingSlots.find(addr) == existingSlots.end()) {
         int token = METHOD_SLOT_SPACE + ++slotCursor;
         m_methods[token] = new JITMethod(this, returnType, std::move(params), addr, false);
-        RegisterSymbol(token, label);
+        symbolTable[token] = label;
         return token;
     } else {
         return existingSlots[addr];
@@ -40,9 +41,11 @@ int BaseModule::AddMethod(CorInfoType returnType, std::vector<Parameter> params,
 }
 
 void BaseModule::RegisterSymbol(int32_t token, const char* label) {
+    std::lock_guard<std::mutex> guard(m_lock);
     symbolTable[token] = label;
 }
 
 SymbolTable BaseModule::GetSymbolTable() {
+    std::lock_guard<std::mutex> guard(m_lock);
     return symbolTable;
 }
\ No newline at end of file
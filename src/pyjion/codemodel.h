@@ -36,6 +36,7 @@
 #include <float.h>
 #include <cstdlib>
 
+#include <mutex>
 #include <utility>
 #include <vector>
 #include <unordered_map>
@@ -69,13 +70,19 @@ class BaseModule : public PyjionBase {
     unordered_map<void*, int> existingSlots;
     int slotCursor = 0;
 
+protected:
+    // RyuJIT resolves tokens without the GIL while other threads emit IL and add methods.
+    std::mutex m_lock;
+
 public:
     unordered_map<int32_t, BaseMethod*> m_methods;
     SymbolTable symbolTable;
     BaseModule() = default;
 
     virtual BaseMethod* ResolveMethod(int32_t tokenId) {
-        return m_methods[tokenId];
+        std::lock_guard<std::mutex> guard(m_lock);
+        auto res = m_methods.find(tokenId);
+        return res == m_methods.end() ? nullptr : res->second;
     }
 
     virtual int AddMethod(CorInfoType returnType, std::vector<Parameter> params, void* addr, const char* label = "typeslot");
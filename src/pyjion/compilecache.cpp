@@ -0,0 +1,144 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#include <algorithm>
+#include "compilecache.h"
+
+CompileCache g_compileCache;
+
+CompileCacheOptions::CompileCacheOptions(PgcStatus pgcStatus, bool baseline) {
+    optimizations = PyJit_Optimizations();
+    optimizationLevel = PyJit_OptimizationLevel();
+    debug = g_pyjionSettings.debug;
+    exceptionHandling = g_pyjionSettings.exceptionHandling;
+    lazyGeneric = g_pyjionSettings.lazyGeneric;
+    pgc = PyJit_PgcEnabled();
+    osrThreshold = g_pyjionSettings.osrThreshold;
+    // Without PGC the status doesn't change the emitted code
+    this->pgcStatus = pgc ? pgcStatus : Uncompiled;
+    this->baseline = baseline;
+}
+
+bool CompileCacheOptions::operator==(const CompileCacheOptions& other) const {
+    return optimizations == other.optimizations &&
+           optimizationLevel == other.optimizationLevel &&
+           debug == other.debug &&
+           exceptionHandling == other.exceptionHandling &&
+           lazyGeneric == other.lazyGeneric &&
+           pgc == other.pgc &&
+           osrThreshold == other.osrThreshold &&
+           pgcStatus == other.pgcStatus &&
+           baseline == other.baseline;
+}
+
+Py_hash_t CompileCache::hash(PyObject* code) {
+    // Code objects hash their bytecode, constants, names and signature. Nested code objects
+    // loaded from the constants carry the file name, so that's part of the key as well.
+    Py_hash_t codeHash = PyObject_Hash(code);
+    if (codeHash == -1) {
+        PyErr_Clear();
+        return -1;
+    }
+    Py_hash_t fileHash = PyObject_Hash(((PyCodeObject*) code)->co_filename);
+    if (fileHash == -1) {
+        PyErr_Clear();
+        return -1;
+    }
+    return codeHash ^ (fileHash * 1000003);
+}
+
+bool CompileCache::matches(const Entry& entry, PyObject* code, PyObject* builtins, const CompileCacheOptions& options, const vector<AbstractValueKind>& kinds) {
+    if (entry.builtins != builtins || !(entry.options == options) || entry.kinds != kinds)
+        return false;
+    if (entry.code == code)
+        return true;
+    // Code object equality compares constants by type as well as value, so 1 and 1.0 don't match.
+    int equal = PyObject_RichCompareBool(entry.code, code, Py_EQ);
+    if (equal == 1)
+        equal = PyUnicode_Compare(((PyCodeObject*) entry.code)->co_filename, ((PyCodeObject*) code)->co_filename) == 0;
+    if (PyErr_Occurred()) {
+        PyErr_Clear();
+        return false;
+    }
+    return equal == 1;
+}
+
+PyObject* CompileCache::find(PyObject* code, PyObject* builtins, const CompileCacheOptions& options, const vector<AbstractValueKind>& kinds, AbstactInterpreterCompileResult& result) {
+    auto key = hash(code);
+    if (key == -1)
+        return nullptr;
+    auto range = m_entries.equal_range(key);
+    for (auto entry = range.first; entry != range.second; ++entry) {
+        if (matches(entry->second, code, builtins, options, kinds)) {
+            entry->second.lastUsed = ++m_clock;
+            result = entry->second.result;
+            return entry->second.code;
+        }
+    }
+    return nullptr;
+}
+
+void CompileCache::insert(PyObject* code, PyObject* builtins, const CompileCacheOptions& options, const vector<AbstractValueKind>& kinds, const AbstactInterpreterCompileResult& result) {
+    size_t capacity = g_pyjionSettings.compileCacheSize;
+    auto key = hash(code);
+    if (key == -1 || capacity == 0)
+        return;
+    // Another thread may have compiled an identical code object while the GIL was released
+    auto range = m_entries.equal_range(key);
+    for (auto entry = range.first; entry != range.second; ++entry) {
+        if (matches(entry->second, code, builtins, options, kinds))
+            return;
+    }
+    trim(capacity - 1);
+
+    Entry entry{code, builtins, options, kinds, result, ++m_clock};
+    // Graphs belong to the code object which asked for them
+    entry.result.instructionGraph = nullptr;
+    entry.result.genericGraph = nullptr;
+    Py_INCREF(code);
+    Py_INCREF(builtins);
+    m_entries.emplace(key, entry);
+}
+
+void CompileCache::release(Entry& entry) {
+    // Code objects already using the native code hold their own references to what it embeds
+    Py_DECREF(entry.code);
+    Py_DECREF(entry.builtins);
+}
+
+void CompileCache::trim(size_t capacity) {
+    while (m_entries.size() > capacity) {
+        auto lru = std::min_element(m_entries.begin(), m_entries.end(),
+                                    [](const std::pair<const Py_hash_t, Entry>& a, const std::pair<const Py_hash_t, Entry>& b) { return a.second.lastUsed < b.second.lastUsed; });
+        release(lru->second);
+        m_entries.erase(lru);
+    }
+}
+
+void CompileCache::clear() {
+    for (auto& entry : m_entries)
+        release(entry.second);
+    m_entries.clear();
+}
@@ -0,0 +1,87 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#ifndef PYJION_COMPILECACHE_H
+#define PYJION_COMPILECACHE_H
+
+#include <Python.h>
+#include <unordered_map>
+#include <vector>
+#include "pyjit.h"
+#include "absint.h"
+
+/* Everything besides the code object and its arguments which changes what the compiler emits. */
+struct CompileCacheOptions {
+    OptimizationFlags optimizations;
+    uint8_t optimizationLevel;
+    DebugMode debug;
+    bool exceptionHandling;
+    bool lazyGeneric;
+    bool pgc;
+    uint32_t osrThreshold;
+    PgcStatus pgcStatus;
+    bool baseline;
+
+    CompileCacheOptions(PgcStatus pgcStatus, bool baseline);
+    bool operator==(const CompileCacheOptions& other) const;
+};
+
+/* Compiled code shared between code objects with the same bytecode, constants and names.
+ * Compiled code embeds the constants and names of the code object it was compiled from, so an
+ * entry keeps that code object alive. Globals are only used behind a check of the dict's version
+ * tag, which no other dict shares, so code in another module runs the same native code and looks
+ * its globals up. The builtins are compared by identity before the frame's locals are flushed for
+ * vars() and friends, so entries only match code running against the same builtins.
+ * Caller must hold the GIL for all methods. */
+class CompileCache {
+    struct Entry {
+        PyObject* code;
+        PyObject* builtins;
+        CompileCacheOptions options;
+        vector<AbstractValueKind> kinds;
+        AbstactInterpreterCompileResult result;
+        PY_UINT64_T lastUsed;
+    };
+    std::unordered_multimap<Py_hash_t, Entry> m_entries;
+    PY_UINT64_T m_clock = 0;
+
+    static Py_hash_t hash(PyObject* code);
+    static bool matches(const Entry& entry, PyObject* code, PyObject* builtins, const CompileCacheOptions& options, const vector<AbstractValueKind>& kinds);
+    static void release(Entry& entry);
+
+public:
+    // Copies a previous result for an identical code object into result and returns the code object
+    // it was compiled from (borrowed), or nullptr on a miss.
+    PyObject* find(PyObject* code, PyObject* builtins, const CompileCacheOptions& options, const vector<AbstractValueKind>& kinds, AbstactInterpreterCompileResult& result);
+    void insert(PyObject* code, PyObject* builtins, const CompileCacheOptions& options, const vector<AbstractValueKind>& kinds, const AbstactInterpreterCompileResult& result);
+    // Drop the least recently used entries until there are no more than capacity left.
+    void trim(size_t capacity);
+    size_t size() { return m_entries.size(); }
+    void clear();
+};
+
+extern CompileCache g_compileCache;
+
+#endif//PYJION_COMPILECACHE_H
@@ -0,0 +1,300 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#include <algorithm>
+#include "compilequeue.h"
+
+CompileQueue* g_compileQueue;
+CompileBudget g_compileBudget;
+JitPool* g_jitPool;
+
+void CompileBudget::refill(uint16_t budget) {
+    auto now = std::chrono::steady_clock::now();
+    int64_t capacity = (int64_t) budget * 1000 * 1000;
+    if (!m_started) {
+        m_balance = capacity;
+        m_started = true;
+    } else {
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - m_refilled).count();
+        m_balance = std::min(capacity, m_balance + elapsed * budget);
+    }
+    m_refilled = now;
+}
+
+void CompileBudget::charge(std::chrono::microseconds elapsed) {
+    uint16_t budget = g_pyjionSettings.compileBudget;
+    if (budget == 0)
+        return;
+    std::lock_guard<std::mutex> guard(m_lock);
+    refill(budget);
+    m_balance -= elapsed.count() * 1000;
+}
+
+void CompileBudget::reset() {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_started = false;
+}
+
+std::chrono::microseconds CompileBudget::delay() {
+    uint16_t budget = g_pyjionSettings.compileBudget;
+    if (budget == 0)
+        return std::chrono::microseconds(0);
+    std::lock_guard<std::mutex> guard(m_lock);
+    refill(budget);
+    if (m_balance > 0)
+        return std::chrono::microseconds(0);
+    return std::chrono::microseconds(-m_balance / budget + 1);
+}
+
+CompileJob::CompileJob(PyjionJittedCode* jitted, PyFrameObject* frame, CompileJobKind kind) {
+    m_jitted = jitted;
+    m_kind = kind;
+    m_jitted->j_compilePending = true;
+    Py_INCREF(m_jitted->j_code);
+    m_builtins = frame->f_builtins;
+    Py_INCREF(m_builtins);
+    m_globals = frame->f_globals;
+    Py_INCREF(m_globals);
+    // Capture the arguments now, the frame is free to rebind them once it starts executing.
+    int argCount = frame->f_code->co_argcount + frame->f_code->co_kwonlyargcount;
+    m_args = std::vector<PyObject*>(argCount);
+    for (int i = 0; i < argCount; i++) {
+        m_args[i] = frame->f_localsplus[i];
+        Py_XINCREF(m_args[i]);
+    }
+}
+
+CompileJob::~CompileJob() {
+    for (auto& arg : m_args) {
+        Py_XDECREF(arg);
+    }
+    Py_DECREF(m_globals);
+    Py_DECREF(m_builtins);
+    Py_DECREF(m_jitted->j_code);
+}
+
+PY_UINT64_T CompileJob::hotness() const {
+    return m_jitted->j_hotness;
+}
+
+void CompileJob::run() {
+    CodePolicyScope policy(m_jitted);
+    switch (m_kind) {
+        case PrimaryVariant:
+            PyJit_CompileCode(m_jitted, m_builtins, m_globals, m_args.data(), (int) m_args.size());
+            m_jitted->j_pgcStatus = nextPgcStatus(m_jitted->j_pgcStatus);
+            break;
+        case GenericVariant:
+            PyJit_CompileGeneric(m_jitted, m_builtins, m_globals);
+            break;
+        case SpecializationVariant:
+            PyJit_CompileSpecialization(m_jitted, m_builtins, m_globals, m_args.data(), (int) m_args.size());
+            break;
+        case HooksVariant:
+            PyJit_CompileHooks(m_jitted, m_builtins, m_globals);
+            break;
+    }
+    m_jitted->j_compilePending = false;
+}
+
+void CompileJob::cancel() {
+    m_jitted->j_compilePending = false;
+}
+
+void CompileQueue::push(CompileJob* job) {
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_jobs.push_back(job);
+        if (!m_running) {
+            m_running = true;
+            for (unsigned int i = 0; i < JitPool::threads(); i++)
+                m_workers.emplace_back(&CompileQueue::work, this);
+        }
+    }
+    m_wake.notify_one();
+}
+
+size_t CompileQueue::pending() {
+    std::lock_guard<std::mutex> guard(m_lock);
+    return m_jobs.size() + m_inFlight.size();
+}
+
+void CompileQueue::work() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            m_wake.wait(lock, [this] { return !m_running || !m_jobs.empty(); });
+            if (!m_running)
+                return;
+            auto delay = g_compileBudget.delay();
+            if (delay.count() > 0 && m_draining == 0) {
+                m_wake.wait_for(lock, delay);
+                continue;
+            }
+        }
+
+        // Hotness is updated by the evaluation loop, so the job is picked with the GIL held.
+        auto gil = PyGILState_Ensure();
+        CompileJob* job;
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            if (!m_running) {
+                PyGILState_Release(gil);
+                return;
+            }
+            auto hottest = std::max_element(m_jobs.begin(), m_jobs.end(),
+                                            [](const CompileJob* a, const CompileJob* b) { return a->hotness() < b->hotness(); });
+            job = *hottest;
+            m_jobs.erase(hottest);
+            m_inFlight.push_back(job);
+        }
+        // The abstract interpreter and IL generation read the code object, its constants and the
+        // types they refer to, so they run with the GIL held. Only the RyuJIT compile (emit_compile)
+        // releases it, and runs alongside the other Python threads and the other workers. Each code
+        // object has at most one job queued, so workers never compile the same one.
+        job->run();
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            m_inFlight.erase(std::find(m_inFlight.begin(), m_inFlight.end(), job));
+        }
+        delete job;
+        PyGILState_Release(gil);
+        m_idle.notify_all();
+    }
+}
+
+void CompileQueue::drain() {
+    // Release the lock before taking back the GIL, push() is called with the GIL held.
+    Py_BEGIN_ALLOW_THREADS
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        // Counted, so one caller finishing doesn't put the budget back for another still waiting.
+        m_draining++;
+        m_wake.notify_one();
+        m_idle.wait(lock, [this] { return !m_running || (m_jobs.empty() && m_inFlight.empty()); });
+        m_draining--;
+    }
+    Py_END_ALLOW_THREADS
+}
+
+void CompileQueue::shutdown() {
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        if (!m_running)
+            return;
+        m_running = false;
+    }
+    m_wake.notify_all();
+    m_idle.notify_all();
+    // The workers may be waiting on the GIL to finish their current jobs.
+    Py_BEGIN_ALLOW_THREADS
+    for (auto& worker : m_workers)
+        worker.join();
+    Py_END_ALLOW_THREADS
+    m_workers.clear();
+
+    std::deque<CompileJob*> discarded;
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        discarded.swap(m_jobs);
+    }
+    for (auto& job : discarded) {
+        job->cancel();
+        delete job;
+    }
+}
+
+void CompileQueue::abandon() {
+    // The lock may have been held by a parent thread when the process forked, and only the forking
+    // thread exists now, so it isn't taken.
+    for (auto& job : m_inFlight) {
+        // A worker was compiling this job when the process forked. Its compile was cut short, so
+        // clear the code object's pending flag and the child queues it again when it's next called.
+        // The job itself is leaked rather than deleted: the abstract interpreter, IL generator and
+        // method it was building sit on the worker's stack and still reference its arguments, and
+        // their state in the child is whatever it was mid-compile, so none of it can be released.
+        job->cancel();
+    }
+    m_inFlight.clear();
+    for (auto& job : m_jobs) {
+        job->cancel();
+        delete job;
+    }
+    m_jobs.clear();
+}
+
+unsigned int JitPool::threads() {
+    return std::max(1u, std::min(4u, std::thread::hardware_concurrency() / 2));
+}
+
+JitPool* JitPool::get() {
+    if (g_jitPool == nullptr && std::thread::hardware_concurrency() > 1)
+        g_jitPool = new JitPool();
+    return g_jitPool;
+}
+
+std::future<void*> JitPool::submit(std::function<void*()> task) {
+    std::packaged_task<void*()> packaged(std::move(task));
+    auto result = packaged.get_future();
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_tasks.push_back(std::move(packaged));
+        if (!m_running) {
+            m_running = true;
+            for (unsigned int i = 0; i < threads(); i++)
+                m_workers.emplace_back(&JitPool::work, this);
+        }
+    }
+    m_wake.notify_one();
+    return result;
+}
+
+void JitPool::work() {
+    while (true) {
+        std::packaged_task<void*()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            m_wake.wait(lock, [this] { return !m_running || !m_tasks.empty(); });
+            if (m_tasks.empty())
+                return;
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task();
+    }
+}
+
+void JitPool::shutdown() {
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        if (!m_running)
+            return;
+        m_running = false;
+    }
+    m_wake.notify_all();
+    for (auto& worker : m_workers)
+        worker.join();
+    m_workers.clear();
+}
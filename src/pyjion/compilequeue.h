@@ -0,0 +1,148 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#ifndef PYJION_COMPILEQUEUE_H
+#define PYJION_COMPILEQUEUE_H
+
+#include <Python.h>
+#include <frameobject.h>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <future>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "pyjit.h"
+
+enum CompileJobKind {
+    PrimaryVariant,       // The specialized variant, stepping the PGC status
+    GenericVariant,       // The generic variant, on the first specialization miss
+    SpecializationVariant,// An additional entry in the specialization table
+    HooksVariant          // The variant with tracing and profiling hooks
+};
+
+/* A single pending compilation. The job keeps strong references to everything the
+ * abstract interpreter needs so that it can outlive the frame which requested it. */
+class CompileJob {
+    PyjionJittedCode* m_jitted;
+    PyObject* m_builtins;
+    PyObject* m_globals;
+    std::vector<PyObject*> m_args;
+    CompileJobKind m_kind;
+
+public:
+    CompileJob(PyjionJittedCode* jitted, PyFrameObject* frame, CompileJobKind kind = PrimaryVariant);
+    // Must be destroyed with the GIL held.
+    ~CompileJob();
+
+    // Caller must hold the GIL.
+    PY_UINT64_T hotness() const;
+
+    void run();
+    void cancel();
+};
+
+/* Token bucket limiting the share of wall-clock time spent compiling. The bucket refills at
+ * compileBudget milliseconds per second and holds at most one second's worth, a compile
+ * which overdraws it has to be paid back before the next one can start. */
+class CompileBudget {
+    std::mutex m_lock;
+    std::chrono::steady_clock::time_point m_refilled;
+    // In microseconds of compile time multiplied by 1000, so small refills aren't rounded away
+    int64_t m_balance = 0;
+    bool m_started = false;
+
+    void refill(uint16_t budget);
+
+public:
+    void charge(std::chrono::microseconds elapsed);
+    // Start again with a full bucket, when the budget is changed.
+    void reset();
+    // How long until another compile can start, zero if it can start now.
+    std::chrono::microseconds delay();
+    bool available() { return delay().count() == 0; }
+};
+
+extern CompileBudget g_compileBudget;
+
+/* Background compiler. Jobs are pushed from the evaluation loop and compiled on worker
+ * threads, which hold the GIL while a job is analysed and emitted and release it while
+ * RyuJIT compiles the IL. With more than one worker, the variants queued for different
+ * code objects compile in parallel: one worker's RyuJIT compile runs while another emits
+ * the next job. The hottest code object is compiled first, and jobs wait for the compile
+ * budget unless the queue is being drained. */
+class CompileQueue {
+    std::deque<CompileJob*> m_jobs;
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    std::condition_variable m_idle;
+    std::vector<std::thread> m_workers;
+    bool m_running = false;
+    size_t m_draining = 0;// Callers blocked in drain(), the budget is ignored while non-zero
+    std::vector<CompileJob*> m_inFlight;
+
+    void work();
+
+public:
+    void push(CompileJob* job);
+    size_t pending();
+    // Block until all queued jobs have been compiled, caller must hold the GIL.
+    void drain();
+    // Stop the workers and discard queued jobs, caller must hold the GIL.
+    void shutdown();
+    // In a forked child, where the workers don't exist, clear the pending flag of every job they
+    // would have compiled so the evaluation loop compiles them again.
+    void abandon();
+};
+
+extern CompileQueue* g_compileQueue;
+
+/* Native threads which run RyuJIT for the variants of a function in parallel. Tasks only
+ * read the emitted IL and method tables, so the workers never take the GIL. */
+class JitPool {
+    std::deque<std::packaged_task<void*()>> m_tasks;
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    std::vector<std::thread> m_workers;
+    bool m_running = false;
+
+    void work();
+
+public:
+    // The pool, or nullptr when there's no spare core to run it on.
+    static JitPool* get();
+    // Threads to compile on, the compile queue runs as many workers as the pool.
+    static unsigned int threads();
+
+    std::future<void*> submit(std::function<void*()> task);
+    // Stop the workers once the queued tasks have run.
+    void shutdown();
+};
+
+extern JitPool* g_jitPool;
+
+#endif//PYJION_COMPILEQUEUE_H
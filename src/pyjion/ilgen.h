@@ -713,6 +713,8 @@ public:
 #if (defined(HOST_OSX) && defined(HOST_ARM64))
         pthread_jit_write_protect_np(1);
 #endif
+        if (result == CORJIT_OK && !jitInfo->protectCode())
+            result = CORJIT_OUTOFMEM;
         jitInfo->setNativeSize(nativeSizeOfCode);
         switch (result) {
             case CORJIT_OK:
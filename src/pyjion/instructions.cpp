@@ -348,6 +348,7 @@ PyObject* InstructionGraph::makeGraph(const char* name) {
                 break;
             case SETUP_WITH:
             case SETUP_ASYNC_WITH:
+                exceptionHandlers.insert(node.second.jumpsTo);
                 op = PyUnicode_FromFormat("\tOP%u [label=\"%u %s (%d)\" color=\"%s\"];\n", node.first, node.first, opcodeName(node.second.opcode), node.second.oparg, blockColor);
                 PyUnicode_AppendAndDel(&g, PyUnicode_FromFormat("subgraph cluster_%u {\nlabel = \"with block\";\n", node.first));
                 break;
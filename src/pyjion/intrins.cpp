@@ -1635,6 +1635,23 @@ PyObject* PyJit_GetUnboxedIter(PyObject* iterable) {
     }
 }
 
+PyObject* PyJit_BoxRangeIterator(PyObject* iter) {
+    if (!PyjionRangeIter_Check(iter))
+        return iter;
+    // range_iterator has no public constructor, iterate over the remainder of the range instead
+    auto* r = (pyjion_rangeiterobject*) iter;
+    auto remaining = PyObject_CallFunction((PyObject*) &PyRange_Type, "LLL",
+                                           (long long) (r->start + r->index * r->step),
+                                           (long long) (r->start + r->len * r->step),
+                                           (long long) r->step);
+    Py_DECREF(iter);
+    if (remaining == nullptr)
+        return nullptr;
+    auto res = PyObject_GetIter(remaining);
+    Py_DECREF(remaining);
+    return res;
+}
+
 PyObject* PyJit_GetIter(PyObject* iterable) {
     auto res = PyObject_GetIter(iterable);
     Py_DECREF(iterable);
@@ -1687,7 +1704,9 @@ PyObject* PyJit_IterNextUnboxed(PyObject* iter) {
         if (next == nullptr){
             return (PyObject*) SIG_STOP_ITER;
         }
-        return (PyObject*)PyLong_AsLongLong(next); // Unbox the value
+        auto value = PyLong_AsLongLong(next); // Unbox the value
+        Py_DECREF(next);
+        return (PyObject*) value;
     } else {
         // Err.. I'm outta ideas
         PyErr_SetString(PyExc_ValueError, "Invalid type in PyJit_IterNextUnboxed");
@@ -2520,6 +2539,9 @@ inline void initialize_trace_info(PyTraceInfo* trace_info, PyFrameObject* frame)
 void PyJit_TraceLine(PyFrameObject* f, int instr_prev, PyTraceInfo* trace_info) {
     int result = 0;
     auto tstate = PyThreadState_GET();
+    // The hooks variant is shared with frames which only have a profile function
+    if (!trace_info->cframe.use_tracing || tstate->c_tracefunc == nullptr)
+        return;
     /* If the last instruction falls at the start of a line or if it
        represents a jump backwards, update the frame's line number and
        then call the trace function if we're tracing source lines.
@@ -2801,6 +2823,7 @@ void PyJit_PgcGuardException(PyObject* obj, const char* expected) {
     assert(PyjionUnboxingError != nullptr);
     if (PyErr_Occurred())
         return;
+    PyJit_RecordGuardFailure(PyThreadState_GET()->frame);
     PyErr_Format(PyjionUnboxingError,
                  "Optimizations are invalid. Pyjion PGC expected %s, but %s is a %s. Try disabling PGC pyjion.config(pgc=False) or lowering the optimization level to avoid hitting this error.",
                  expected,
@@ -2808,6 +2831,30 @@ void PyJit_PgcGuardException(PyObject* obj, const char* expected) {
                  obj->ob_type->tp_name);
 }
 
+int PyJit_CanUnboxLong(PyObject* obj) {
+    // Mirrors what PyJit_LongAsLongLong will accept, bool is a subclass of int
+    if (!PyLong_Check(obj))
+        return 0;
+    int overflow = 0;
+    PyLong_AsLongLongAndOverflow(obj, &overflow);
+    return overflow == 0;
+}
+
+PyObject* PyJit_Deoptimize(PyFrameObject* frame, PyThreadState* tstate) {
+    // The jitted code has written the value stack, f_lasti and f_stackdepth,
+    // so the interpreter picks up at the instruction that failed the guard.
+    g_pyjionStats.deoptimizations++;
+    PyJit_RecordGuardFailure(frame);
+    return _PyEval_EvalFrameDefault(tstate, frame, 0);
+}
+
+PyObject* PyJit_LeaveRegion(PyFrameObject* frame, PyThreadState* tstate) {
+    // Only the start of an oversized function is compiled, the interpreter runs the rest of it
+    // from the frame state the jitted code has written.
+    g_pyjionStats.regionExits++;
+    return _PyEval_EvalFrameDefault(tstate, frame, 0);
+}
+
 PyObject* PyJit_BlockPop(PyFrameObject* frame) {
     if (frame->f_iblock <= 0) {
 #ifdef DEBUG
@@ -2881,4 +2928,184 @@ int PyJit_StoreByteArrayUnboxed(int64_t value, PyObject* array, int64_t index){
     PyByteArray_AS_STRING(array)[index] = (char)value;
     Py_DECREF(array);
     return 0;
-}
\ No newline at end of file
+}
+PyObject* PyJit_Send(PyObject* receiver, PyObject* value, int* status) {
+    PyObject* result;
+    *status = PyIter_Send(receiver, value, &result);
+    Py_DECREF(value);
+    return result;
+}
+
+static bool PyJit_IsIterableCoroutine(PyObject* o) {
+    return PyGen_CheckExact(o) && (((PyCodeObject*) ((PyGenObject*) o)->gi_code)->co_flags & CO_ITERABLE_COROUTINE);
+}
+
+// Equivalent of _PyCoro_GetAwaitableIter, which isn't exported
+static PyObject* PyJit_GetAwaitableIter(PyObject* o) {
+    if (PyCoro_CheckExact(o) || PyJit_IsIterableCoroutine(o)) {
+        Py_INCREF(o);
+        return o;
+    }
+    auto type = Py_TYPE(o);
+    unaryfunc getter = type->tp_as_async != nullptr ? type->tp_as_async->am_await : nullptr;
+    if (getter == nullptr) {
+        PyErr_Format(PyExc_TypeError, "object %.100s can't be used in 'await' expression", type->tp_name);
+        return nullptr;
+    }
+    auto res = getter(o);
+    if (res != nullptr) {
+        if (PyCoro_CheckExact(res) || PyJit_IsIterableCoroutine(res)) {
+            PyErr_SetString(PyExc_TypeError, "__await__() returned a coroutine");
+            Py_CLEAR(res);
+        } else if (!PyIter_Check(res)) {
+            PyErr_Format(PyExc_TypeError, "__await__() returned non-iterator of type '%.100s'", Py_TYPE(res)->tp_name);
+            Py_CLEAR(res);
+        }
+    }
+    return res;
+}
+
+PyObject* PyJit_GetAwaitable(PyObject* iterable) {
+    auto iter = PyJit_GetAwaitableIter(iterable);
+    Py_DECREF(iterable);
+    if (iter != nullptr && PyCoro_CheckExact(iter)) {
+        // A coroutine suspended in a YIELD_FROM is already being awaited
+        auto frame = ((PyGenObject*) iter)->gi_frame;
+        if (frame != nullptr && frame->f_lasti >= 0) {
+            auto code = (_Py_CODEUNIT*) PyBytes_AS_STRING(frame->f_code->co_code);
+            if (_Py_OPCODE(code[frame->f_lasti + 1]) == YIELD_FROM) {
+                Py_CLEAR(iter);
+                PyErr_SetString(PyExc_RuntimeError, "coroutine is being awaited already");
+            }
+        }
+    }
+    return iter;
+}
+
+PyObject* PyJit_GetAIter(PyObject* obj) {
+    auto type = Py_TYPE(obj);
+    unaryfunc getter = type->tp_as_async != nullptr ? type->tp_as_async->am_aiter : nullptr;
+    if (getter == nullptr) {
+        PyErr_Format(PyExc_TypeError, "'async for' requires an object with __aiter__ method, got %.100s", type->tp_name);
+        Py_DECREF(obj);
+        return nullptr;
+    }
+    auto iter = getter(obj);
+    Py_DECREF(obj);
+    if (iter == nullptr)
+        return nullptr;
+    if (Py_TYPE(iter)->tp_as_async == nullptr || Py_TYPE(iter)->tp_as_async->am_anext == nullptr) {
+        PyErr_Format(PyExc_TypeError, "'async for' received an object from __aiter__ that does not implement __anext__: %.100s",
+                     Py_TYPE(iter)->tp_name);
+        Py_DECREF(iter);
+        return nullptr;
+    }
+    return iter;
+}
+
+PyObject* PyJit_GetANext(PyObject* aiter) {
+    auto type = Py_TYPE(aiter);
+    if (PyAsyncGen_CheckExact(aiter))
+        return type->tp_as_async->am_anext(aiter);
+    unaryfunc getter = type->tp_as_async != nullptr ? type->tp_as_async->am_anext : nullptr;
+    if (getter == nullptr) {
+        PyErr_Format(PyExc_TypeError, "'async for' requires an iterator with __anext__ method, got %.100s", type->tp_name);
+        return nullptr;
+    }
+    auto nextIter = getter(aiter);
+    if (nextIter == nullptr)
+        return nullptr;
+    auto awaitable = PyJit_GetAwaitableIter(nextIter);
+    if (awaitable == nullptr) {
+        _PyErr_FormatFromCause(PyExc_TypeError, "'async for' received an invalid object from __anext__: %.100s", Py_TYPE(nextIter)->tp_name);
+    }
+    Py_DECREF(nextIter);
+    return awaitable;
+}
+
+PyObject* PyJit_GetYieldFromIter(PyObject* iterable, int coroutine) {
+    if (PyCoro_CheckExact(iterable)) {
+        if (!coroutine) {
+            PyErr_SetString(PyExc_TypeError, "cannot 'yield from' a coroutine object in a non-coroutine generator");
+            Py_DECREF(iterable);
+            return nullptr;
+        }
+        return iterable;
+    }
+    if (PyGen_CheckExact(iterable))
+        return iterable;
+    auto iter = PyObject_GetIter(iterable);
+    Py_DECREF(iterable);
+    return iter;
+}
+
+int PyJit_IsStopAsyncIteration(PyObject* exc) {
+    return PyErr_GivenExceptionMatches(exc, PyExc_StopAsyncIteration);
+}
+
+static PyObject* PyJit_SpecialLookup(PyObject* obj, _Py_Identifier* id) {
+    auto res = _PyObject_LookupSpecial(obj, id);
+    if (res == nullptr && !PyErr_Occurred()) {
+        PyErr_SetObject(PyExc_AttributeError, _PyUnicode_FromId(id));
+    }
+    return res;
+}
+
+static PyObject* PyJit_EnterContext(PyObject* mgr, PyObject** result, _Py_Identifier* enterId, _Py_Identifier* exitId) {
+    auto enter = PyJit_SpecialLookup(mgr, enterId);
+    if (enter == nullptr) {
+        Py_DECREF(mgr);
+        return nullptr;
+    }
+    auto exit = PyJit_SpecialLookup(mgr, exitId);
+    Py_DECREF(mgr);
+    if (exit == nullptr) {
+        Py_DECREF(enter);
+        return nullptr;
+    }
+    auto res = _PyObject_CallNoArg(enter);
+    Py_DECREF(enter);
+    if (res == nullptr) {
+        Py_DECREF(exit);
+        return nullptr;
+    }
+    *result = res;
+    return exit;
+}
+
+PyObject* PyJit_SetupWith(PyObject* mgr, PyObject** result) {
+    _Py_IDENTIFIER(__enter__);
+    _Py_IDENTIFIER(__exit__);
+    return PyJit_EnterContext(mgr, result, &PyId___enter__, &PyId___exit__);
+}
+
+PyObject* PyJit_SetupWithKnownType(PyObject* mgr, PyObject** result, PyTypeObject* type, unsigned int versionTag, PyObject* enter, PyObject* exit) {
+    // enter and exit are borrowed from the type, they are only valid while its version tag is unchanged
+    if (Py_TYPE(mgr) != type || !PyType_HasFeature(type, Py_TPFLAGS_VALID_VERSION_TAG) || type->tp_version_tag != versionTag)
+        return PyJit_SetupWith(mgr, result);
+    auto boundExit = Py_TYPE(exit)->tp_descr_get(exit, mgr, (PyObject*) type);
+    if (boundExit == nullptr) {
+        Py_DECREF(mgr);
+        return nullptr;
+    }
+    // __enter__ is a method descriptor, so it can be called with the manager as self without binding it
+    auto res = PyObject_Vectorcall(enter, &mgr, 1, nullptr);
+    Py_DECREF(mgr);
+    if (res == nullptr) {
+        Py_DECREF(boundExit);
+        return nullptr;
+    }
+    *result = res;
+    return boundExit;
+}
+
+PyObject* PyJit_BeforeAsyncWith(PyObject* mgr, PyObject** result) {
+    _Py_IDENTIFIER(__aenter__);
+    _Py_IDENTIFIER(__aexit__);
+    return PyJit_EnterContext(mgr, result, &PyId___aenter__, &PyId___aexit__);
+}
+
+PyObject* PyJit_WithExceptStart(PyObject* exit, PyObject* exc, PyObject* val, PyObject* tb) {
+    PyObject* stack[4] = {nullptr, exc, val, tb};
+    return PyObject_Vectorcall(exit, stack + 1, 3 | PY_VECTORCALL_ARGUMENTS_OFFSET, nullptr);
+}
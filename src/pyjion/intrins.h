@@ -139,6 +139,9 @@ void PyJit_DebugType(PyTypeObject* ty);
 void PyJit_DebugPyObject(PyObject* obj);
 void PyJit_DebugFault(char* msg, char* context, int32_t index, PyFrameObject* frame);
 void PyJit_PgcGuardException(PyObject* obj, const char* expected);
+int PyJit_CanUnboxLong(PyObject* obj);
+PyObject* PyJit_Deoptimize(PyFrameObject* frame, PyThreadState* tstate);
+PyObject* PyJit_LeaveRegion(PyFrameObject* frame, PyThreadState* tstate);
 void PyJit_PyErrRestore(PyObject* tb, PyObject* value, PyObject* exception);
 
 PyObject* PyJit_ImportName(PyObject* level, PyObject* from, PyObject* name, PyFrameObject* f);
@@ -202,6 +205,7 @@ PyObject* PyJit_GetUnboxedIter(PyObject* iterable);
 
 PyObject* PyJit_IterNext(PyObject* iter);
 PyObject* PyJit_IterNextUnboxed(PyObject* iter);
+PyObject* PyJit_BoxRangeIterator(PyObject* iter);
 
 PyObject* PyJit_PyTuple_New(int32_t len);
 
@@ -284,4 +288,16 @@ int64_t PyJit_LongAsLongLong(PyObject*, int*);
 int8_t PyJit_UnboxBool(PyObject*, int*);
 
 int PyJit_StoreByteArrayUnboxed(int64_t, PyObject*, int64_t);
+
+PyObject* PyJit_Send(PyObject* receiver, PyObject* value, int* status);
+PyObject* PyJit_GetAwaitable(PyObject* iterable);
+PyObject* PyJit_GetAIter(PyObject* obj);
+PyObject* PyJit_GetANext(PyObject* aiter);
+PyObject* PyJit_GetYieldFromIter(PyObject* iterable, int coroutine);
+int PyJit_IsStopAsyncIteration(PyObject* exc);
+
+PyObject* PyJit_SetupWith(PyObject* mgr, PyObject** result);
+PyObject* PyJit_SetupWithKnownType(PyObject* mgr, PyObject** result, PyTypeObject* type, unsigned int versionTag, PyObject* enter, PyObject* exit);
+PyObject* PyJit_BeforeAsyncWith(PyObject* mgr, PyObject** result);
+PyObject* PyJit_WithExceptStart(PyObject* exit, PyObject* exc, PyObject* val, PyObject* tb);
 #endif
\ No newline at end of file
@@ -485,6 +485,20 @@ public:
     virtual void emit_infinity_long() = 0;
     virtual void emit_nan_long() = 0;
     virtual void emit_guard_exception(const char* expected) = 0;
+    // Consumes an object and pushes true if it can be unboxed as kind without failing
+    virtual void emit_guard_check(AbstractValueKind kind) = 0;
+    // Hands the frame to the interpreter to resume at resumeIndex, pushes the result of the frame
+    virtual void emit_deoptimize(py_opindex resumeIndex, uint32_t stackDepth) = 0;
+    // Hands the frame to the interpreter at the point already stored in the frame
+    virtual void emit_resume_in_interpreter() = 0;
+    // Pushes true if optimized code with on-stack-replacement entries is ready for this frame
+    virtual void emit_prepare_on_stack_replace() = 0;
+    // Continues the frame in the optimized code from resumeIndex, pushes the result of the frame
+    virtual void emit_on_stack_replace(py_opindex resumeIndex, uint32_t stackDepth) = 0;
+    // Hands the frame to the interpreter to run the rest of the function from resumeIndex, pushes the result of the frame
+    virtual void emit_leave_region(py_opindex resumeIndex, uint32_t stackDepth) = 0;
+    // Converts an unboxed range iterator into one the interpreter can run
+    virtual void emit_box_range_iterator() = 0;
 
     virtual void emit_store_in_frame_value_stack(uint32_t idx) = 0;
     virtual void emit_load_from_frame_value_stack(uint32_t idx) = 0;
@@ -493,6 +507,27 @@ public:
 
     virtual void emit_return_value(Local, Label) = 0;
     virtual void emit_yield_value(Local retValue, Label retLabel, py_opindex index, size_t stackSize, offsetLabels& yieldOffsets) = 0;
+    // Sends the value on the top of the stack to the receiver below it, replacing the value with the
+    // result and storing the PySendResult in status
+    virtual void emit_send(Local status) = 0;
+    // Replaces the object on the top of the stack with its awaitable iterator
+    virtual void emit_get_awaitable() = 0;
+    // Replaces the object on the top of the stack with its async iterator
+    virtual void emit_get_aiter() = 0;
+    // Pushes the awaitable for the next value of the async iterator on the top of the stack
+    virtual void emit_get_anext() = 0;
+    // Replaces the object on the top of the stack with the iterator for a yield from
+    virtual void emit_get_yield_from_iter(bool coroutine) = 0;
+    // Consumes an exception type and pushes true if it's a StopAsyncIteration
+    virtual void emit_is_stop_async_iteration() = 0;
+    // Replaces the context manager on the top of the stack with its bound __exit__, storing the result of __enter__ in result
+    virtual void emit_setup_with(Local result) = 0;
+    // Enters a context manager of a known type with its cached __enter__ and __exit__, returns false if they can't be cached
+    virtual bool emit_setup_with(Local result, PyTypeObject* type) = 0;
+    // Replaces the context manager on the top of the stack with its bound __aexit__, storing the result of __aenter__ in result
+    virtual void emit_before_async_with(Local result) = 0;
+    // Calls the __exit__ below the exception and previous exception with the exception, pushing the result
+    virtual void emit_with_except_start() = 0;
 };
 
 #endif
\ No newline at end of file
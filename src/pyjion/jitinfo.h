@@ -43,10 +43,7 @@
 #include "cee.h"
 #include "ipycomp.h"
 #include "exceptions.h"
-
-#ifndef WINDOWS
-#include <sys/mman.h>
-#endif
+#include "codeheap.h"
 
 #ifdef DEBUG_VERBOSE
 #define WARN(msg, ...) printf(#msg, ##__VA_ARGS__);
@@ -63,7 +60,7 @@ extern "C" void stackProbeHelper();// Implemented in helpers.asm
 const CORINFO_CLASS_HANDLE PYOBJECT_PTR_TYPE = (CORINFO_CLASS_HANDLE) 0x11;
 
 class CorJitInfo : public ICorJitInfo, public JittedCode {
-    void* m_codeAddr;
+    CodeHeap::Block m_code;
     void* m_dataAddr;
     const char* m_moduleName;
     const char* m_methodName;
@@ -73,39 +70,35 @@ class CorJitInfo : public ICorJitInfo, public JittedCode {
     vector<SequencePoint> m_sequencePoints;
     vector<CallPoint> m_callPoints;
     DebugMode m_compileDebug;
+    bool m_minOpts;
 
     volatile const GSCookie s_gsCookie = 0x1234;
 
 #ifdef WINDOWS
-    HANDLE m_winHeap;
     SYSTEM_INFO systemInfo;
 #endif
 
 public:
-    CorJitInfo(const char* moduleName, const char* methodName, UserModule* module, DebugMode compileDebug) {
-        m_codeAddr = m_dataAddr = nullptr;
+    CorJitInfo(const char* moduleName, const char* methodName, UserModule* module, DebugMode compileDebug, bool minOpts = false) {
+        m_code = {nullptr, nullptr, 0};
+        m_dataAddr = nullptr;
         m_methodName = methodName;
         m_moduleName = moduleName;
         m_module = module;
         m_il = vector<uint8_t>(0);
         m_nativeSize = 0;
         m_compileDebug = compileDebug;
+        m_minOpts = minOpts;
 #ifdef WINDOWS
-        m_winHeap = HeapCreate(HEAP_CREATE_ENABLE_EXECUTE, 0, 0);
         GetSystemInfo(&systemInfo);
 #endif
     }
 
     ~CorJitInfo() override {
-        if (m_codeAddr != nullptr) {
-            freeMem(m_codeAddr);
-        }
+        g_codeHeap.release(m_code);
         if (m_dataAddr != nullptr) {
             free(m_dataAddr);
         }
-#ifdef WINDOWS
-        HeapDestroy(m_winHeap);
-#endif
         delete m_module;
     }
 
@@ -160,7 +153,13 @@ public:
     }
 
     void* get_code_addr() override {
-        return m_codeAddr;
+        return m_code.rx;
+    }
+
+    // Make the code executable once RyuJIT has applied its relocations, where it isn't written
+    // through a separate view.
+    bool protectCode() {
+        return g_codeHeap.seal(m_code);
     }
 
     void get_il(unsigned char** out, unsigned int * outLen) override {
@@ -204,43 +203,36 @@ public:
         return m_module->GetSymbolTable();
     }
 
-    void freeMem(PVOID code) {
-        PyMem_Free(code);
-    }
-
     void allocMem(
             AllocMemArgs* pArgs) override {
-        // NB: Not honouring flag alignment requested in <flag>, but it is "optional"
-#ifdef WINDOWS
-        pArgs->hotCodeBlock = m_codeAddr = HeapAlloc(m_winHeap, 0, pArgs->hotCodeSize);
-#else
-#if defined(__APPLE__) && defined(MAP_JIT)
-        const int mode = MAP_PRIVATE | MAP_ANONYMOUS | MAP_JIT;
-#elif defined(MAP_ANONYMOUS)
-        const int mode = MAP_PRIVATE | MAP_ANONYMOUS;
-#elif defined(MAP_ANON)
-        const int mode = MAP_PRIVATE | MAP_ANON;
-#else
-#error "not supported"
-#endif
-        pArgs->hotCodeBlock = m_codeAddr = mmap(
-                nullptr,
-                pArgs->hotCodeSize,
-                PROT_READ | PROT_WRITE | PROT_EXEC,
-                mode,
-                -1,
-                0);
-        assert(pArgs->hotCodeBlock != MAP_FAILED);
-#endif
-
-        if (pArgs->coldCodeSize > 0)// PyMem_Malloc passes with 0 but it confuses the JIT
-            pArgs->coldCodeBlock = PyMem_Malloc(pArgs->coldCodeSize);
-        if (pArgs->roDataSize > 0)// Same as above
-            pArgs->roDataBlock = PyMem_Malloc(pArgs->roDataSize);
-
-        pArgs->hotCodeBlockRW = pArgs->hotCodeBlock;
-        pArgs->coldCodeBlockRW = pArgs->coldCodeBlock;
-        pArgs->roDataBlockRW = pArgs->roDataBlock;
+        // Cold code and read-only data share the block with the hot code. Nothing writes to a block once
+        // the method is compiled, so code compiled before a fork stays shared with the child processes.
+        // Blocks start on a cache line, which covers the alignment the JIT can ask for the hot code.
+        size_t codeAlign = (pArgs->flag & CORJIT_ALLOCMEM_FLG_32BYTE_ALIGN) ? 32 : 16;
+        size_t roDataAlign = (pArgs->flag & CORJIT_ALLOCMEM_FLG_RODATA_32BYTE_ALIGN) ? 32 : 16;
+        size_t coldOffset = (pArgs->hotCodeSize + codeAlign - 1) & ~(codeAlign - 1);
+        size_t roDataOffset = (coldOffset + pArgs->coldCodeSize + roDataAlign - 1) & ~(roDataAlign - 1);
+        // Called without the GIL, the code heap has its own lock. RyuJIT's error trap turns the exception
+        // into a failed compile.
+        m_code = g_codeHeap.allocate(roDataOffset + pArgs->roDataSize);
+        if (m_code.rx == nullptr)
+            throw OutOfMemoryException();
+
+        // The JIT writes through the RW addresses, which are a separate view of the same memory when
+        // the code heap has one.
+        pArgs->hotCodeBlock = m_code.rx;
+        pArgs->hotCodeBlockRW = m_code.rw;
+        // The JIT is confused by blocks for empty sections
+        pArgs->coldCodeBlock = pArgs->coldCodeBlockRW = nullptr;
+        pArgs->roDataBlock = pArgs->roDataBlockRW = nullptr;
+        if (pArgs->coldCodeSize > 0) {
+            pArgs->coldCodeBlock = m_code.rx + coldOffset;
+            pArgs->coldCodeBlockRW = m_code.rw + coldOffset;
+        }
+        if (pArgs->roDataSize > 0) {
+            pArgs->roDataBlock = m_code.rx + roDataOffset;
+            pArgs->roDataBlockRW = m_code.rw + roDataOffset;
+        }
     }
 
     bool logMsg(unsigned level, const char* fmt, va_list args) override {
@@ -277,18 +269,19 @@ public:
         int64_t delta;
         switch (fRelocType) {
             case IMAGE_REL_BASED_DIR64:
-                *((uint64_t*) ((uint8_t*) location + slotNum)) = (uint64_t) target;
+                *((uint64_t*) ((uint8_t*) locationRW + slotNum)) = (uint64_t) target;
                 break;
             case IMAGE_REL_BASED_REL32: {
                 target = (uint8_t*) target + addlDelta;
 
                 auto* fixupLocation = (int32_t*) ((uint8_t*) location + slotNum);
+                auto* fixupLocationRW = (int32_t*) ((uint8_t*) locationRW + slotNum);
                 uint8_t* baseAddr = (uint8_t*) fixupLocation + sizeof(int32_t);
 
                 auto delta = (int64_t) ((uint8_t*) target - baseAddr);
 
                 // Write the 32-bits pc-relative delta into location
-                *fixupLocation = (int32_t) delta;
+                *fixupLocationRW = (int32_t) delta;
             } break;
             case IMAGE_REL_ARM64_BRANCH26:// 26 bit offset << 2 & sign ext, for B and BL
             {
@@ -1507,7 +1500,8 @@ public:
             case DebugMode::ReleaseWithDebugInfo:
                 flags->Add(flags->CORJIT_FLAG_DEBUG_INFO);
             case DebugMode::Release:
-                flags->Add(flags->CORJIT_FLAG_SPEED_OPT);
+                // Baseline code is either thrown away after profiling or replaced once it stays hot
+                flags->Add(m_minOpts ? flags->CORJIT_FLAG_MIN_OPT : flags->CORJIT_FLAG_SPEED_OPT);
                 break;
             default:
                 break;
@@ -1779,7 +1773,7 @@ public:
     }
 
     void* allocGCInfo(size_t size) override {
-        return PyMem_Malloc(size);
+        return PyMem_RawMalloc(size);
     }
 
     void setEHcount(unsigned int cEH) override {
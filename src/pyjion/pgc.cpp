@@ -65,6 +65,120 @@ AbstractValueKind PyjionCodeProfile::getKind(size_t opcodePosition, size_t stack
     return this->stackKinds[opcodePosition][stackPosition];
 }
 
+bool PyjionCodeProfile::onlyObjects(size_t opcodePosition) {
+    auto observed = this->stackKinds.find(opcodePosition);
+    if (observed == this->stackKinds.end() || observed->second.empty())
+        return false;
+    for (auto& kind : observed->second) {
+        if (kind.second != AVK_Any)
+            return false;
+    }
+    return true;
+}
+
+void PyjionCodeProfile::clear() {
+    // Types stay referenced for the same reason as in the destructor
+    this->stackTypes.clear();
+    this->stackKinds.clear();
+}
+
+unordered_map<uint64_t, SavedProfile> g_savedProfiles;
+
+static string qualifiedTypeName(PyTypeObject* type) {
+    string name;
+    PyObject* module = PyObject_GetAttrString((PyObject*) type, "__module__");
+    PyObject* qualname = PyObject_GetAttrString((PyObject*) type, "__qualname__");
+    if (module != nullptr && qualname != nullptr && PyUnicode_Check(module) && PyUnicode_Check(qualname)) {
+        auto moduleName = PyUnicode_AsUTF8(module);
+        auto typeName = PyUnicode_AsUTF8(qualname);
+        // Types defined inside functions can't be found again
+        if (moduleName != nullptr && typeName != nullptr && strstr(typeName, "<locals>") == nullptr)
+            name = string(moduleName) + ":" + typeName;
+    }
+    Py_XDECREF(module);
+    Py_XDECREF(qualname);
+    PyErr_Clear();
+    return name;
+}
+
+// Only looks in modules which are already imported, and only reads their dicts and those of the
+// classes on the way, loading a profile mustn't run module code or __getattr__ hooks.
+static PyTypeObject* resolveTypeName(const string& name) {
+    auto separator = name.find(':');
+    if (separator == string::npos)
+        return nullptr;
+    PyObject* obj = PyDict_GetItemString(PyImport_GetModuleDict(), name.substr(0, separator).c_str());
+    size_t start = separator + 1;
+    while (obj != nullptr && start <= name.size()) {
+        PyObject* dict;
+        if (PyModule_CheckExact(obj))
+            dict = PyModule_GetDict(obj);
+        else if (PyType_Check(obj))
+            dict = ((PyTypeObject*) obj)->tp_dict;
+        else
+            return nullptr;
+        auto end = name.find('.', start);
+        if (end == string::npos)
+            end = name.size();
+        obj = dict == nullptr ? nullptr : PyDict_GetItemString(dict, name.substr(start, end - start).c_str());
+        start = end + 1;
+    }
+    if (obj == nullptr || !PyType_Check(obj))
+        return nullptr;
+    // Kept referenced like recorded types
+    Py_INCREF(obj);
+    return (PyTypeObject*) obj;
+}
+
+SavedProfile PyjionCodeProfile::save() {
+    SavedProfile saved;
+    for (auto& position : this->stackTypes) {
+        for (auto& observed : position.second) {
+            if (observed.second == nullptr)
+                continue;
+            auto name = qualifiedTypeName(observed.second);
+            if (name.empty())
+                continue;
+            saved[{position.first, observed.first}] = SavedProfileEntry{name, this->stackKinds[position.first][observed.first]};
+        }
+    }
+    return saved;
+}
+
+size_t PyjionCodeProfile::load(const SavedProfile& saved) {
+    size_t loaded = 0;
+    for (auto& entry : saved) {
+        if (entry.second.type.empty())
+            continue;
+        auto type = resolveTypeName(entry.second.type);
+        if (type == nullptr)
+            continue;
+        auto opcodePosition = entry.first.first;
+        auto stackPosition = entry.first.second;
+        if (this->stackTypes[opcodePosition][stackPosition] == nullptr) {
+            this->stackTypes[opcodePosition][stackPosition] = type;
+        } else {
+            Py_DECREF(type);
+        }
+        this->stackKinds[opcodePosition][stackPosition] = entry.second.kind;
+        loaded++;
+    }
+    return loaded;
+}
+
+void mergeSavedProfile(uint64_t key, const SavedProfile& profile) {
+    auto& merged = g_savedProfiles[key];
+    for (auto& entry : profile) {
+        auto existing = merged.find(entry.first);
+        if (existing == merged.end()) {
+            merged.insert(entry);
+        } else if (existing->second.type != entry.second.type || existing->second.kind != entry.second.kind) {
+            // Polymorphic between processes, leave it unspecialized
+            existing->second.type.clear();
+        }
+    }
+}
+
 void capturePgcStackValue(PyjionCodeProfile* profile, PyObject* value, size_t opcodePosition, size_t stackPosition) {
     if (value != nullptr && profile != nullptr) {
         profile->record(opcodePosition, stackPosition, value);
@@ -31,6 +31,7 @@
 #include "pycomp.h"
 #include "pyjit.h"
 #include "unboxing.h"
+#include "compilequeue.h"
 
 using namespace std;
 
@@ -39,7 +40,7 @@ CCorJitHost g_jitHost;
 BaseModule g_module;
 ICorJitCompiler* g_jit;
 
-PythonCompiler::PythonCompiler(PyCodeObject* code) : m_il(m_module = new UserModule(g_module),
+PythonCompiler::PythonCompiler(PyCodeObject* code, bool minOpts) : m_il(m_module = new UserModule(g_module),
                                                           CORINFO_TYPE_NATIVEINT,
                                                           std::vector<Parameter>{
                                                                   Parameter(CORINFO_TYPE_NATIVEINT),// PyjionJittedCode*
@@ -51,6 +52,22 @@ PythonCompiler::PythonCompiler(PyCodeObject* code) : m_il(m_module = new UserMod
     m_code = code;
     m_lasti = m_il.define_local(Parameter(CORINFO_TYPE_NATIVEINT));
     m_compileDebug = g_pyjionSettings.debug;
+    m_compileMinOpts = minOpts;
+}
+
+PythonCompiler::~PythonCompiler() {
+    // An exception while emitting another variant can leave RyuJIT running on our IL
+    if (m_pendingJit.valid()) {
+        try {
+            delete join_compile();
+        } catch (...) {
+        }
+    }
+}
+
+bool PythonCompiler::compile_in_background() {
+    m_compileInBackground = JitPool::get() != nullptr;
+    return m_compileInBackground;
 }
 
 void PythonCompiler::load_frame() {
@@ -185,7 +202,7 @@ void PythonCompiler::emit_set_frame_stackdepth(uint32_t to) {
     load_frame();
     LD_FIELDA(PyFrameObject, f_stackdepth);
     m_il.ld_u4(to);
-    m_il.st_ind_i();
+    m_il.st_ind_i4();
 }
 
 void PythonCompiler::load_local(py_oparg oparg) {
@@ -2360,9 +2377,34 @@ void PythonCompiler::emit_call_function_inline(py_oparg n_args, AbstractValueWit
     decref();
 }
 
+// Releases the GIL for the lifetime of the scope, including when RyuJIT throws.
+class GilRelease {
+    PyThreadState* m_tstate;
+
+public:
+    GilRelease() : m_tstate(PyEval_SaveThread()) {}
+    ~GilRelease() {
+        PyEval_RestoreThread(m_tstate);
+    }
+};
+
 JittedCode* PythonCompiler::emit_compile() {
-    auto* jitInfo = new CorJitInfo(PyUnicode_AsUTF8(m_code->co_filename), PyUnicode_AsUTF8(m_code->co_name), m_module, m_compileDebug);
-    auto addr = m_il.compile(jitInfo, g_jit, m_code->co_stacksize + 100).m_addr;
+    auto* jitInfo = new CorJitInfo(PyUnicode_AsUTF8(m_code->co_filename), PyUnicode_AsUTF8(m_code->co_name), m_module, m_compileDebug, m_compileMinOpts);
+    auto stackSize = m_code->co_stacksize + 100;
+    if (m_compileInBackground) {
+        m_pendingJitInfo = jitInfo;
+        m_pendingJit = JitPool::get()->submit([this, jitInfo, stackSize] {
+            return m_il.compile(jitInfo, g_jit, stackSize).m_addr;
+        });
+        return jitInfo;
+    }
+    void* addr;
+    {
+        // Everything RyuJIT needs was built while emitting the IL. The JitInfo callbacks only read
+        // the method tables and use the raw allocator, so other Python threads can run meanwhile.
+        GilRelease release;
+        addr = m_il.compile(jitInfo, g_jit, stackSize).m_addr;
+    }
     if (addr == nullptr) {
 #ifdef REPORT_CLR_FAULTS
         printf("Compiling failed %s from %s line %d\r\n",
@@ -2376,6 +2418,24 @@ JittedCode* PythonCompiler::emit_compile() {
     return jitInfo;
 }
 
+JittedCode* PythonCompiler::join_compile() {
+    auto jitInfo = m_pendingJitInfo;
+    m_pendingJitInfo = nullptr;
+    void* addr = nullptr;
+    try {
+        GilRelease release;
+        addr = m_pendingJit.get();
+    } catch (...) {
+        delete jitInfo;
+        throw;
+    }
+    if (addr == nullptr) {
+        delete jitInfo;
+        return nullptr;
+    }
+    return jitInfo;
+}
+
 void PythonCompiler::mark_sequence_point(size_t idx) {
     m_il.mark_sequence_point(idx);
 }
@@ -2477,6 +2537,75 @@ void PythonCompiler::emit_guard_exception(const char* expected) {
     m_il.emit_call(METHOD_PGC_GUARD_EXCEPTION);
 }
 
+void PythonCompiler::emit_guard_check(AbstractValueKind kind) {
+    switch (kind) {
+        case AVK_Float:
+            LD_FIELDI(PyObject, ob_type);
+            emit_ptr(&PyFloat_Type);
+            m_il.compare_eq();
+            break;
+        case AVK_Bool:
+            LD_FIELDI(PyObject, ob_type);
+            emit_ptr(&PyBool_Type);
+            m_il.compare_eq();
+            break;
+        case AVK_Integer:
+            m_il.emit_call(METHOD_PGC_GUARD_CHECK_INT);
+            break;
+        case AVK_UnboxedRangeIterator:
+            // Unboxed FOR_ITER also accepts the interpreter's range iterator
+            LD_FIELDI(PyObject, ob_type);
+            emit_ptr(&PyRangeIter_Type);
+            m_il.compare_eq();
+            break;
+        default:
+            throw UnexpectedValueException();
+    }
+}
+
+void PythonCompiler::set_resume_point(py_opindex resumeIndex, uint32_t stackDepth) {
+    // The interpreter resumes at f_lasti + 1
+    m_il.ld_loc(m_lasti);
+    m_il.ld_i4((int32_t) (resumeIndex / 2) - 1);
+    m_il.st_ind_i4();
+    emit_set_frame_stackdepth(stackDepth);
+}
+
+void PythonCompiler::emit_deoptimize(py_opindex resumeIndex, uint32_t stackDepth) {
+    set_resume_point(resumeIndex, stackDepth);
+    emit_resume_in_interpreter();
+}
+
+void PythonCompiler::emit_resume_in_interpreter() {
+    load_frame();
+    load_tstate();
+    m_il.emit_call(METHOD_DEOPTIMIZE);
+}
+
+void PythonCompiler::emit_prepare_on_stack_replace() {
+    load_frame();
+    load_tstate();
+    m_il.emit_call(METHOD_PREPARE_OSR);
+}
+
+void PythonCompiler::emit_on_stack_replace(py_opindex resumeIndex, uint32_t stackDepth) {
+    set_resume_point(resumeIndex, stackDepth);
+    load_frame();
+    load_tstate();
+    m_il.emit_call(METHOD_ON_STACK_REPLACE);
+}
+
+void PythonCompiler::emit_leave_region(py_opindex resumeIndex, uint32_t stackDepth) {
+    set_resume_point(resumeIndex, stackDepth);
+    load_frame();
+    load_tstate();
+    m_il.emit_call(METHOD_LEAVE_REGION);
+}
+
+void PythonCompiler::emit_box_range_iterator() {
+    m_il.emit_call(METHOD_BOX_RANGE_ITERATOR);
+}
+
 void PythonCompiler::emit_unbox(AbstractValueKind kind, bool guard, Local success) {
 #ifdef DEBUG
     assert(supportsEscaping(kind));
@@ -2716,6 +2845,100 @@ void PythonCompiler::emit_yield_value(Local retValue, Label retLabel, py_opindex
     emit_dec_frame_stackdepth(stackSize);
 }
 
+void PythonCompiler::emit_send(Local status) {
+    auto value = m_il.define_local(Parameter(CORINFO_TYPE_NATIVEINT));
+    m_il.st_loc(value);
+    m_il.dup();
+    m_il.ld_loc(value);
+    emit_load_local_addr(status);
+    m_il.emit_call(METHOD_SEND);
+    m_il.free_local(value);
+}
+
+void PythonCompiler::emit_get_awaitable() {
+    m_il.emit_call(METHOD_GET_AWAITABLE);
+}
+
+void PythonCompiler::emit_get_aiter() {
+    m_il.emit_call(METHOD_GET_AITER);
+}
+
+void PythonCompiler::emit_get_anext() {
+    m_il.dup();
+    m_il.emit_call(METHOD_GET_ANEXT);
+}
+
+void PythonCompiler::emit_get_yield_from_iter(bool coroutine) {
+    m_il.ld_i4(coroutine);
+    m_il.emit_call(METHOD_GET_YIELD_FROM_ITER);
+}
+
+void PythonCompiler::emit_is_stop_async_iteration() {
+    m_il.emit_call(METHOD_IS_STOP_ASYNC_ITERATION);
+}
+
+void PythonCompiler::emit_setup_with(Local result) {
+    emit_load_local_addr(result);
+    m_il.emit_call(METHOD_SETUP_WITH);
+}
+
+bool PythonCompiler::emit_setup_with(Local result, PyTypeObject* type) {
+    _Py_IDENTIFIER(__enter__);
+    _Py_IDENTIFIER(__exit__);
+    auto enterName = _PyUnicode_FromId(&PyId___enter__), exitName = _PyUnicode_FromId(&PyId___exit__);
+    if (enterName == nullptr || exitName == nullptr) {
+        PyErr_Clear();
+        return false;
+    }
+    // The lookup assigns the type a version tag, which is checked before the cached methods are used
+    auto enter = _PyType_Lookup(type, enterName);
+    auto exit = _PyType_Lookup(type, exitName);
+    if (enter == nullptr || exit == nullptr ||
+        !PyType_HasFeature(Py_TYPE(enter), Py_TPFLAGS_METHOD_DESCRIPTOR) ||
+        !PyType_HasFeature(Py_TYPE(exit), Py_TPFLAGS_METHOD_DESCRIPTOR) ||
+        Py_TYPE(exit)->tp_descr_get == nullptr ||
+        !PyType_HasFeature(type, Py_TPFLAGS_VALID_VERSION_TAG))
+        return false;
+    emit_load_local_addr(result);
+    emit_ptr(type);
+    m_il.ld_i4((int32_t) type->tp_version_tag);
+    emit_ptr(enter);
+    emit_ptr(exit);
+    m_il.emit_call(METHOD_SETUP_WITH_KNOWN_TYPE);
+    return true;
+}
+
+void PythonCompiler::emit_before_async_with(Local result) {
+    emit_load_local_addr(result);
+    m_il.emit_call(METHOD_BEFORE_ASYNC_WITH);
+}
+
+void PythonCompiler::emit_with_except_start() {
+    // Stack is __exit__, the previous exception and the exception, with the exception type on top
+    Local exc = emit_define_local(LK_Pointer), val = emit_define_local(LK_Pointer), tb = emit_define_local(LK_Pointer);
+    Local prevExc = emit_define_local(LK_Pointer), prevVal = emit_define_local(LK_Pointer), prevTb = emit_define_local(LK_Pointer);
+    Local result = emit_define_local(LK_Pointer);
+    emit_store_local(exc);
+    emit_store_local(val);
+    emit_store_local(tb);
+    emit_store_local(prevExc);
+    emit_store_local(prevVal);
+    emit_store_local(prevTb);
+    m_il.dup();
+    emit_load_local(exc);
+    emit_load_local(val);
+    emit_load_local(tb);
+    m_il.emit_call(METHOD_WITH_EXCEPT_START);
+    emit_store_local(result);
+    emit_load_and_free_local(prevTb);
+    emit_load_and_free_local(prevVal);
+    emit_load_and_free_local(prevExc);
+    emit_load_and_free_local(tb);
+    emit_load_and_free_local(val);
+    emit_load_and_free_local(exc);
+    emit_load_and_free_local(result);
+}
+
 /************************************************************************
 * End Compiler interface implementation
 */
@@ -2974,9 +3197,25 @@ GLOBAL_METHOD(METHOD_PROFILE_FRAME_EXIT, &PyJit_ProfileFrameExit, CORINFO_TYPE_V
 GLOBAL_METHOD(METHOD_LOAD_CLOSURE, &PyJit_LoadClosure, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_INT));
 
 GLOBAL_METHOD(METHOD_PENDING_CALLS, &Py_MakePendingCalls, CORINFO_TYPE_INT, );
+GLOBAL_METHOD(METHOD_SEND, &PyJit_Send, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_GET_AWAITABLE, &PyJit_GetAwaitable, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_GET_AITER, &PyJit_GetAIter, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_GET_ANEXT, &PyJit_GetANext, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_GET_YIELD_FROM_ITER, &PyJit_GetYieldFromIter, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_INT));
+GLOBAL_METHOD(METHOD_IS_STOP_ASYNC_ITERATION, &PyJit_IsStopAsyncIteration, CORINFO_TYPE_INT, Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_SETUP_WITH, &PyJit_SetupWith, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_SETUP_WITH_KNOWN_TYPE, &PyJit_SetupWithKnownType, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_INT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_BEFORE_ASYNC_WITH, &PyJit_BeforeAsyncWith, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_WITH_EXCEPT_START, &PyJit_WithExceptStart, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
 
 GLOBAL_METHOD(METHOD_PGC_PROBE, &capturePgcStackValue, CORINFO_TYPE_VOID, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
 GLOBAL_METHOD(METHOD_PGC_GUARD_EXCEPTION, &PyJit_PgcGuardException, CORINFO_TYPE_VOID, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_PGC_GUARD_CHECK_INT, &PyJit_CanUnboxLong, CORINFO_TYPE_INT, Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_DEOPTIMIZE, &PyJit_Deoptimize, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_PREPARE_OSR, &PyJit_PrepareOnStackReplace, CORINFO_TYPE_INT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_ON_STACK_REPLACE, &PyJit_OnStackReplace, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_LEAVE_REGION, &PyJit_LeaveRegion, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_BOX_RANGE_ITERATOR, &PyJit_BoxRangeIterator, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT));
 GLOBAL_METHOD(METHOD_SEQUENCE_AS_LIST, &PySequence_List, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT));
 GLOBAL_METHOD(METHOD_LIST_ITEM_FROM_BACK, &PyJit_GetListItemReversed, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
 
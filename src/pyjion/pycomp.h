@@ -30,6 +30,7 @@
 
 #include <intrin.h>
 #include <climits>
+#include <future>
 #include <cfloat>
 
 #include "ipycomp.h"
@@ -143,6 +144,16 @@
 #define METHOD_LOAD_CLOSURE                  0x0000007A
 #define METHOD_LOADNAME_HASH                 0x0000007B
 #define METHOD_PENDING_CALLS                 0x0000007C
+#define METHOD_SEND                          0x0000007D
+#define METHOD_GET_AWAITABLE                 0x0000007E
+#define METHOD_GET_AITER                     0x0000007F
+#define METHOD_GET_ANEXT                     0x00000080
+#define METHOD_GET_YIELD_FROM_ITER           0x00000081
+#define METHOD_IS_STOP_ASYNC_ITERATION       0x00000082
+#define METHOD_SETUP_WITH                    0x00000083
+#define METHOD_SETUP_WITH_KNOWN_TYPE         0x00000084
+#define METHOD_BEFORE_ASYNC_WITH             0x00000085
+#define METHOD_WITH_EXCEPT_START             0x00000086
 
 // call helpers
 #define METHOD_CALL_0_TOKEN                  0x00010000
@@ -217,6 +228,12 @@
 #define METHOD_PROFILE_FRAME_EXIT            0x00030015
 #define METHOD_PGC_PROBE                     0x00030016
 #define METHOD_PGC_GUARD_EXCEPTION           0x00030017
+#define METHOD_PGC_GUARD_CHECK_INT           0x00030018
+#define METHOD_DEOPTIMIZE                    0x00030019
+#define METHOD_PREPARE_OSR                   0x0003001A
+#define METHOD_ON_STACK_REPLACE              0x0003001B
+#define METHOD_BOX_RANGE_ITERATOR            0x0003001C
+#define METHOD_LEAVE_REGION                  0x0003001D
 
 #define METHOD_FLOAT_POWER_TOKEN             0x00050000
 #define METHOD_FLOAT_FLOOR_TOKEN             0x00050001
@@ -280,9 +297,20 @@ class PythonCompiler : public IPythonCompiler {
     Local m_lasti;
     Local m_instrCount;
     DebugMode m_compileDebug;
+    bool m_compileMinOpts;
+    // Set when emit_compile hands RyuJIT to the JIT pool
+    bool m_compileInBackground = false;
+    CorJitInfo* m_pendingJitInfo = nullptr;
+    std::future<void*> m_pendingJit;
 
 public:
-    explicit PythonCompiler(PyCodeObject* code);
+    explicit PythonCompiler(PyCodeObject* code, bool minOpts = false);
+    ~PythonCompiler();
+
+    // Have emit_compile return as soon as RyuJIT is started on the JIT pool, the compiled code is
+    // collected with join_compile. Returns false if there is no pool to use.
+    bool compile_in_background();
+    JittedCode* join_compile();
 
     void emit_rot_two(LocalKind kind) override;
 
@@ -528,6 +556,13 @@ public:
     void emit_infinity_long() override;
     void emit_nan_long() override;
     void emit_guard_exception(const char* expected) override;
+    void emit_guard_check(AbstractValueKind kind) override;
+    void emit_deoptimize(py_opindex resumeIndex, uint32_t stackDepth) override;
+    void emit_resume_in_interpreter() override;
+    void emit_prepare_on_stack_replace() override;
+    void emit_on_stack_replace(py_opindex resumeIndex, uint32_t stackDepth) override;
+    void emit_leave_region(py_opindex resumeIndex, uint32_t stackDepth) override;
+    void emit_box_range_iterator() override;
 
     void emit_store_in_frame_value_stack(uint32_t idx) override;
     void emit_load_from_frame_value_stack(uint32_t idx) override;
@@ -535,12 +570,23 @@ public:
     void emit_set_frame_stackdepth(uint32_t to) override;
     void emit_return_value(Local, Label) override;
     void emit_yield_value(Local retValue, Label retLabel, py_opindex index, size_t stackSize, offsetLabels& yieldOffsets) override;
+    void emit_send(Local status) override;
+    void emit_get_awaitable() override;
+    void emit_get_aiter() override;
+    void emit_get_anext() override;
+    void emit_get_yield_from_iter(bool coroutine) override;
+    void emit_is_stop_async_iteration() override;
+    void emit_setup_with(Local result) override;
+    bool emit_setup_with(Local result, PyTypeObject* type) override;
+    void emit_before_async_with(Local result) override;
+    void emit_with_except_start() override;
 private:
     void load_frame();
     void load_tstate();
     void load_profile();
     void load_trace_info();
     void load_local(py_oparg oparg);
+    void set_resume_point(py_opindex resumeIndex, uint32_t stackDepth);
     void decref(bool noopt = false);
     CorInfoType to_clr_type(LocalKind kind);
     void pop_top() override;
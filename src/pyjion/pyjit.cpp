@@ -23,9 +23,14 @@
 *
 */
 
+#include <algorithm>
+#include <chrono>
 #include <Python.h>
 #include "pyjit.h"
 #include "pycomp.h"
+#include "compilequeue.h"
+#include "compilecache.h"
+#include "codeheap.h"
 
 #ifdef WINDOWS
 #define BUFSIZE 65535
@@ -39,16 +44,17 @@ typedef void(__cdecl* JITSTARTUP)(ICorJitHost*);
 #define MAX_UINT16_T 65535
 
 PyjionSettings g_pyjionSettings;
+PyjionStatistics g_pyjionStats;
 AttributeTable* g_attrTable;
 extern BaseModule g_module;
-#define SET_OPT(opt, actualLevel, minLevel)                                      \
-    if ((actualLevel) >= (minLevel)) {                                           \
-        g_pyjionSettings.optimizations = g_pyjionSettings.optimizations | (opt); \
+thread_local PyjionCodePolicy t_compilePolicy;
+#define SET_OPT(opt, actualLevel, minLevel) \
+    if ((actualLevel) >= (minLevel)) {      \
+        flags = flags | (opt);              \
     }
 
-void setOptimizationLevel(unsigned short level) {
-    g_pyjionSettings.optimizationLevel = level;
-    g_pyjionSettings.optimizations = OptimizationFlags();
+OptimizationFlags optimizationsForLevel(unsigned short level) {
+    auto flags = OptimizationFlags();
     SET_OPT(InlineIs, level, 1);
     SET_OPT(InlineDecref, level, 1);
     SET_OPT(InternRichCompare, level, 1);
@@ -65,12 +71,19 @@ void setOptimizationLevel(unsigned short level) {
     SET_OPT(AttrTypeTable, level, 1);
     SET_OPT(IntegerUnboxingMultiply, level, 2);
     SET_OPT(OptimisticIntegers, level, 2);
+    return flags;
+}
+
+void setOptimizationLevel(unsigned short level) {
+    g_pyjionSettings.optimizationLevel = level;
+    g_pyjionSettings.optimizations = optimizationsForLevel(level);
 }
 
 PyjionJittedCode::~PyjionJittedCode() {
     delete j_profile;
     this->reset();
     Py_XDECREF(this->j_code);
+    Py_XDECREF(this->j_donor);
 }
 
 void PyjionJittedCode::reset() {
@@ -98,7 +111,12 @@ PyjionJittedCode& PyjionJittedCode::operator = (const PyjionJittedCode& code) {
     j_optimizations = code.j_optimizations;
     j_addr = code.j_addr;
     j_genericAddr = code.j_genericAddr;
+    j_genericFailed = code.j_genericFailed;
+    j_hooksAddr = code.j_hooksAddr;
+    j_hooksFailed = code.j_hooksFailed;
     j_threshold = code.j_threshold;
+    j_hotness = code.j_hotness;
+    j_backEdges = code.j_backEdges;
     j_ilLen = code.j_ilLen;
     j_nativeSize = code.j_nativeSize;
     j_pgcStatus = code.j_pgcStatus;
@@ -107,6 +125,18 @@ PyjionJittedCode& PyjionJittedCode::operator = (const PyjionJittedCode& code) {
     j_symbols = code.j_symbols;
     j_tracingHooks = code.j_tracingHooks;
     j_profilingHooks = code.j_profilingHooks;
+    j_compilePending = code.j_compilePending;
+    j_guardFailures = code.j_guardFailures;
+    j_reprofiles = code.j_reprofiles;
+    j_osrEntries = code.j_osrEntries;
+    j_baseline = code.j_baseline;
+    j_baselineRuns = code.j_baselineRuns;
+    j_probesPending = code.j_probesPending;
+    j_policy = code.j_policy;
+    j_policyExplicit = code.j_policyExplicit;
+    j_policyChecked = code.j_policyChecked;
+    Py_XINCREF(code.j_donor);
+    Py_XSETREF(j_donor, code.j_donor);
     *j_code = *(code.j_code);
     *j_profile = *(code.j_profile);
     *j_il = *(code.j_il);
@@ -249,37 +279,114 @@ bool JitInit(const wchar_t* path) {
     return true;
 }
 
-PyObject* PyJit_ExecuteAndCompileFrame(PyjionJittedCode* state, PyFrameObject* frame, PyThreadState* tstate, PyjionCodeProfile* profile) {
-    // Compile and run the now compiled code...
+// Identifies a code object between processes, unlike PyObject_Hash which is salted per process.
+uint64_t PyJit_StableCodeKey(PyCodeObject* code) {
+    uint64_t key = 14695981039346656037ULL;// FNV-1a
+    auto mix = [&key](const char* data, Py_ssize_t len) {
+        for (Py_ssize_t i = 0; i < len; i++) {
+            key ^= (unsigned char) data[i];
+            key *= 1099511628211ULL;
+        }
+    };
+    auto mixString = [&mix](PyObject* str) {
+        Py_ssize_t len;
+        auto data = PyUnicode_AsUTF8AndSize(str, &len);
+        if (data == nullptr) {
+            PyErr_Clear();
+            return;
+        }
+        mix(data, len + 1);
+    };
+    mix(PyBytes_AS_STRING(code->co_code), PyBytes_GET_SIZE(code->co_code));
+    for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(code->co_names); i++)
+        mixString(PyTuple_GET_ITEM(code->co_names, i));
+    mixString(code->co_filename);
+    mixString(code->co_name);
+    int signature[] = {code->co_firstlineno, code->co_argcount, code->co_kwonlyargcount, code->co_nlocals};
+    mix((const char*) signature, sizeof(signature));
+    return key;
+}
+
+// The GIL is released while RyuJIT compiles, flag the code object as pending for that time so other
+// threads keep running what's already there instead of starting a second compile of it.
+class CompilingScope {
+    PyjionJittedCode* m_state;
+    bool m_pending;
+
+public:
+    explicit CompilingScope(PyjionJittedCode* state) : m_state(state), m_pending(state->j_compilePending) {
+        state->j_compilePending = true;
+    }
+    ~CompilingScope() {
+        m_state->j_compilePending = m_pending;
+    }
+};
+
+// Charge the time spent in the abstract interpreter and the CLR JIT against the compile budget.
+static void PyJit_RecordCompileTime(std::chrono::steady_clock::time_point start) {
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    g_pyjionStats.compileMicroseconds += elapsed.count();
+    g_compileBudget.charge(elapsed);
+}
+
+bool PyJit_CompileCode(PyjionJittedCode* state, PyObject* builtins, PyObject* globals, PyObject** args, int argCount) {
+    CompilingScope compiling(state);
     AbstractInterpreter interp((PyCodeObject*) state->j_code);
-    int argCount = frame->f_code->co_argcount + frame->f_code->co_kwonlyargcount;
     vector<AbstractValueKind> argTypes = vector<AbstractValueKind>(argCount);
     // provide the interpreter information about the specialized types
     for (int i = 0; i < argCount; i++) {
-        interp.setLocalType(i, frame->f_localsplus[i]);
-        if (frame->f_localsplus[i] == nullptr) {
+        interp.setLocalType(i, args[i]);
+        if (args[i] == nullptr) {
             argTypes[i] = AVK_Any;
         } else {
-            argTypes[i] = GetAbstractType(Py_TYPE(frame->f_localsplus[i]), frame->f_localsplus[i]);
+            argTypes[i] = GetAbstractType(Py_TYPE(args[i]), args[i]);
         }
     }
 
-    if (tstate->cframe->use_tracing && tstate->c_tracefunc) {
-        interp.enableTracing();
-        state->j_tracingHooks = true;
-    } else {
-        interp.disableTracing();
-        state->j_tracingHooks = false;
+    // Profiled in an earlier process (or by an identical code object), so skip the probed compile. Only
+    // the first compile uses it, after a reprofile the saved profile is the one which stopped matching.
+    if (PyJit_PgcEnabled() && state->j_pgcStatus == Uncompiled && state->j_addr == nullptr && state->j_reprofiles == 0 && !g_savedProfiles.empty()) {
+        auto saved = g_savedProfiles.find(PyJit_StableCodeKey((PyCodeObject*) state->j_code));
+        if (saved != g_savedProfiles.end() && state->j_profile->load(saved->second) != 0) {
+            state->j_pgcStatus = CompiledWithProbes;
+            g_pyjionStats.profilesLoaded++;
+        }
     }
-    if (tstate->cframe->use_tracing && tstate->c_profilefunc) {
-        interp.enableProfiling();
-        state->j_profilingHooks = true;
+
+    // Probed code only runs until it has a profile, and without PGC the first compile is only
+    // kept until the function proves it's worth the full optimizer.
+    bool baseline = PyJit_PgcEnabled() ? state->j_pgcStatus == Uncompiled : g_pyjionSettings.tierUpThreshold != 0 && state->j_addr == nullptr;
+    if (baseline)
+        interp.enableBaseline();
+
+    // Keep the profile this compile is based on for pyjion.save_profiles()
+    if (PyJit_PgcEnabled() && state->j_pgcStatus == CompiledWithProbes)
+        mergeSavedProfile(PyJit_StableCodeKey((PyCodeObject*) state->j_code), state->j_profile->save());
+
+    // Until the code has been profiled the output only depends on the code object, its builtins and
+    // the settings, so identical code objects (exec'd templates, generated methods) can share it.
+    bool cacheable = g_pyjionSettings.compileCacheSize != 0 && !g_pyjionSettings.graph &&
+                     (!PyJit_PgcEnabled() || state->j_pgcStatus == Uncompiled);
+    CompileCacheOptions cacheOptions(state->j_pgcStatus, baseline);
+    AbstactInterpreterCompileResult res;
+    PyObject* donor = cacheable ? g_compileCache.find(state->j_code, builtins, cacheOptions, argTypes, res) : nullptr;
+    if (donor != nullptr) {
+        g_pyjionStats.cacheHits++;
+        // The native code embeds the donor's constants and names
+        if (donor != state->j_code) {
+            Py_INCREF(donor);
+            Py_XSETREF(state->j_donor, donor);
+        }
     } else {
-        interp.disableProfiling();
-        state->j_profilingHooks = false;
+        auto start = std::chrono::steady_clock::now();
+        res = interp.compile(builtins, globals, state->j_profile, state->j_pgcStatus);
+        PyJit_RecordCompileTime(start);
+        if (cacheable) {
+            g_pyjionStats.cacheMisses++;
+            if (res.compiledCode != nullptr && res.result == Success && (g_pyjionSettings.lazyGeneric || res.genericCompiledCode != nullptr))
+                g_compileCache.insert(state->j_code, builtins, cacheOptions, argTypes, res);
+        }
     }
-
-    auto res = interp.compile(frame->f_builtins, frame->f_globals, profile, state->j_pgcStatus);
     state->j_compileResult = res.result;
     state->j_optimizations = res.optimizations;
     if (g_pyjionSettings.graph) {
@@ -290,20 +397,17 @@ PyObject* PyJit_ExecuteAndCompileFrame(PyjionJittedCode* state, PyFrameObject* f
             Py_DECREF(state->j_genericGraph);
         state->j_genericGraph = res.genericGraph;
     }
-    if (res.compiledCode == nullptr || res.result != Success || res.genericCompiledCode == nullptr) {
+    if (res.compiledCode == nullptr || res.result != Success || (!g_pyjionSettings.lazyGeneric && res.genericCompiledCode == nullptr)) {
         state->j_failed = true;
         state->j_addr = nullptr;// TODO : Raise specific warning when it used to compile and then it didnt the second time.
-        return _PyEval_EvalFrameDefault(tstate, frame, 0);
+        return false;
     }
-    state->j_addr = (Py_EvalFunc) res.compiledCode->get_code_addr();
-    state->j_genericAddr = (Py_EvalFunc) res.genericCompiledCode->get_code_addr();
-    assert(state->j_addr != nullptr);
     res.compiledCode->get_il(&state->j_il, &state->j_ilLen);
     state->j_nativeSize = res.compiledCode->get_native_size();
-    state->j_profile = profile;
     state->j_symbols = res.compiledCode->get_symbol_table();
     res.compiledCode->get_sequence_points(&state->j_sequencePoints, &state->j_sequencePointsLen);
     res.compiledCode->get_call_points(&state->j_callPoints, &state->j_callPointsLen);
+    delete[] state->j_specializedKinds;
     if (argCount > 0) {
         state->j_specializedKinds = new AbstractValueKind[argCount];
         std::copy(argTypes.begin(), argTypes.end(), state->j_specializedKinds);
@@ -311,10 +415,27 @@ PyObject* PyJit_ExecuteAndCompileFrame(PyjionJittedCode* state, PyFrameObject* f
         state->j_specializedKinds = nullptr;
     }
     state->j_specializedKindsLen = argCount;
+    state->j_osrEntries = res.osrEntries;
+    if (state->j_baseline && !baseline)
+        g_pyjionStats.tierUps++;
+    state->j_baseline = baseline;
+    state->j_baselineRuns = 0;
+
+    // Publish the entry points last so the evaluation loop never sees a half-populated state.
+    if (res.genericCompiledCode != nullptr) {
+        if (state->j_genericAddr == nullptr)
+            g_pyjionStats.genericCompiled++;
+        state->j_genericAddr = (Py_EvalFunc) res.genericCompiledCode->get_code_addr();
+    }
+    if (state->j_addr == nullptr)
+        g_pyjionStats.compiled++;
+    state->j_addr = (Py_EvalFunc) res.compiledCode->get_code_addr();
+    assert(state->j_addr != nullptr);
 
 #ifdef DUMP_SEQUENCE_POINTS
-    printf("Method disassembly for %s\n", PyUnicode_AsUTF8(frame->f_code->co_name));
-    auto code = (_Py_CODEUNIT*) PyBytes_AS_STRING(frame->f_code->co_code);
+    auto codeObject = (PyCodeObject*) state->j_code;
+    printf("Method disassembly for %s\n", PyUnicode_AsUTF8(codeObject->co_name));
+    auto code = (_Py_CODEUNIT*) PyBytes_AS_STRING(codeObject->co_code);
     for (size_t i = 0; i < state->j_sequencePointsLen; i++) {
         printf(" %016llX (IL_%04X): %d %s %d\n",
                ((uint64_t) state->j_addr + (uint64_t) state->j_sequencePoints[i].nativeOffset),
@@ -324,11 +445,302 @@ PyObject* PyJit_ExecuteAndCompileFrame(PyjionJittedCode* state, PyFrameObject* f
                _Py_OPARG(code[(state->j_sequencePoints[i].pythonOpcodeIndex) / sizeof(_Py_CODEUNIT)]));
     }
 #endif
+    return true;
+}
+
+bool PyJit_CompileGeneric(PyjionJittedCode* state, PyObject* builtins, PyObject* globals) {
+    CompilingScope compiling(state);
+    AbstractInterpreter interp((PyCodeObject*) state->j_code);
+    auto start = std::chrono::steady_clock::now();
+    auto res = interp.compileGeneric(builtins, globals, state->j_profile);
+    PyJit_RecordCompileTime(start);
+    if (res.genericCompiledCode == nullptr || res.result != Success) {
+        state->j_genericFailed = true;
+        return false;
+    }
+    if (g_pyjionSettings.graph) {
+        if (state->j_genericGraph != nullptr) // discard the old one
+            Py_DECREF(state->j_genericGraph);
+        state->j_genericGraph = res.genericGraph;
+    }
+    g_pyjionStats.genericCompiled++;
+    state->j_genericAddr = (Py_EvalFunc) res.genericCompiledCode->get_code_addr();
+    return true;
+}
+
+// The variant run by frames which start while sys.settrace() or sys.setprofile() is active. The other
+// variants are compiled without hooks, so attaching a debugger or profiler doesn't leave them slow
+// once it's gone. The hook intrinsics check which hooks are set, so one variant serves both.
+bool PyJit_CompileHooks(PyjionJittedCode* state, PyObject* builtins, PyObject* globals) {
+    CompilingScope compiling(state);
+    AbstractInterpreter interp((PyCodeObject*) state->j_code);
+    interp.enableTracing();
+    interp.enableProfiling();
+
+    auto start = std::chrono::steady_clock::now();
+    auto res = interp.compileGeneric(builtins, globals, state->j_profile);
+    PyJit_RecordCompileTime(start);
+    if (res.genericCompiledCode == nullptr || res.result != Success) {
+        state->j_hooksFailed = true;
+        return false;
+    }
+    g_pyjionStats.hooksCompiled++;
+    state->j_hooksAddr = (Py_EvalFunc) res.genericCompiledCode->get_code_addr();
+    state->j_tracingHooks = true;
+    state->j_profilingHooks = true;
+    return true;
+}
+
+Py_EvalFunc PyJit_CompileSpecialization(PyjionJittedCode* state, PyObject* builtins, PyObject* globals, PyObject** args, int argCount) {
+    CompilingScope compiling(state);
+    AbstractInterpreter interp((PyCodeObject*) state->j_code);
+    PyjionSpecialization specialization;
+    specialization.kinds = vector<AbstractValueKind>(argCount);
+    for (int i = 0; i < argCount; i++) {
+        interp.setLocalType(i, args[i]);
+        if (args[i] == nullptr) {
+            specialization.kinds[i] = AVK_Any;
+        } else {
+            specialization.kinds[i] = GetAbstractType(Py_TYPE(args[i]), args[i]);
+        }
+    }
+
+    // The profile was recorded against the primary argument kinds, so compile as Optimized to leave it out.
+    auto start = std::chrono::steady_clock::now();
+    auto res = interp.compile(builtins, globals, state->j_profile, Optimized, false);
+    PyJit_RecordCompileTime(start);
+    if (res.compiledCode == nullptr || res.result != Success) {
+        state->j_megamorphic = true;
+        return nullptr;
+    }
+    specialization.addr = (Py_EvalFunc) res.compiledCode->get_code_addr();
+    specialization.lastUsed = state->j_runCount;
+
+    if (state->j_specializations.size() < g_pyjionSettings.maxSpecializations) {
+        state->j_specializations.push_back(specialization);
+    } else {
+        auto lru = std::min_element(state->j_specializations.begin(), state->j_specializations.end(),
+                                    [](const PyjionSpecialization& a, const PyjionSpecialization& b) { return a.lastUsed < b.lastUsed; });
+        *lru = specialization;
+        // Code which keeps cycling through the table won't settle, stop compiling new variants for it.
+        if (++state->j_specializationEvictions >= g_pyjionSettings.maxSpecializations)
+            state->j_megamorphic = true;
+    }
+    g_pyjionStats.specializations++;
+    return specialization.addr;
+}
+
+static inline bool PyJit_HooksActive(PyThreadState* tstate) {
+    return tstate->cframe->use_tracing && (tstate->c_tracefunc != nullptr || tstate->c_profilefunc != nullptr);
+}
+
+// Compiles which would go over the compile budget are handed to the background queue instead.
+static inline bool PyJit_CompileInline() {
+    if (g_pyjionSettings.asyncCompile)
+        return false;
+    if (g_compileBudget.available())
+        return true;
+    g_pyjionStats.deferredCompiles++;
+    return false;
+}
+
+// Run a frame which starts while a trace or profile function is set. The hooks variant is compiled
+// on first use, until it's available (or if it can't be compiled) the interpreter runs the hooks.
+static PyObject* PyJit_ExecuteHooksFrame(PyjionJittedCode* state, PyFrameObject* frame, PyThreadState* tstate) {
+    if (state->j_hooksAddr != nullptr)
+        return PyJit_ExecuteJittedFrame((void*) state->j_hooksAddr, frame, tstate, state);
+    if (!state->j_hooksFailed && !state->j_compilePending) {
+        if (!PyJit_CompileInline()) {
+            if (g_compileQueue == nullptr)
+                g_compileQueue = new CompileQueue();
+            g_compileQueue->push(new CompileJob(state, frame, HooksVariant));
+        } else if (PyJit_CompileHooks(state, frame->f_builtins, frame->f_globals)) {
+            return PyJit_ExecuteJittedFrame((void*) state->j_hooksAddr, frame, tstate, state);
+        }
+    }
+    return _PyEval_EvalFrameDefault(tstate, frame, 0);
+}
+
+PyObject* PyJit_ExecuteAndCompileFrame(PyjionJittedCode* state, PyFrameObject* frame, PyThreadState* tstate, PyjionCodeProfile* profile) {
+    // Compile and run the now compiled code...
+    int argCount = frame->f_code->co_argcount + frame->f_code->co_kwonlyargcount;
+    state->j_profile = profile;
+    if (!PyJit_CompileCode(state, frame->f_builtins, frame->f_globals, frame->f_localsplus, argCount)) {
+        return _PyEval_EvalFrameDefault(tstate, frame, 0);
+    }
 
     // Execute it now.
+    if (PyJit_HooksActive(tstate))
+        return PyJit_ExecuteHooksFrame(state, frame, tstate);
     return PyJit_ExecuteJittedFrame((void*) state->j_addr, frame, tstate, state);
 }
 
+// The cold frame whose back edges are being counted on this thread.
+struct BackEdgeCounter {
+    PyjionJittedCode* state = nullptr;
+    PyFrameObject* frame = nullptr;
+    int lastInstr = -1;
+};
+static thread_local BackEdgeCounter t_backEdgeCounter;
+
+// Line trace function of a cold frame. The interpreter reports a line event at the first instruction
+// of each line and after every jump backwards. An event which doesn't come after the previous one, or
+// is in the middle of a line, is a back edge.
+static int PyJit_CountBackEdge(PyObject* obj, PyFrameObject* frame, int what, PyObject* arg) {
+    auto& counter = t_backEdgeCounter;
+    if (what != PyTrace_LINE || frame != counter.frame)
+        return 0;
+    int offset = frame->f_lasti * (int) sizeof(_Py_CODEUNIT);
+    if (frame->f_lasti <= counter.lastInstr ||
+        (offset > 0 && PyCode_Addr2Line(frame->f_code, offset - (int) sizeof(_Py_CODEUNIT)) == PyCode_Addr2Line(frame->f_code, offset))) {
+        counter.state->j_hotness += g_pyjionSettings.loopWeight;
+        // Hot enough to be compiled on the next call, the rest of the frame runs untraced
+        if (counter.state->j_hotness >= counter.state->j_threshold)
+            PyThreadState_GET()->c_tracefunc = nullptr;
+    }
+    counter.lastInstr = frame->f_lasti;
+    return 0;
+}
+
+// Frames below the threshold run in the interpreter. Each call adds 1 to the hotness and each back edge
+// the frame takes adds loopWeight, so a function which loops a lot gets hot after a few calls. CPython
+// has no hook for back edges, so frames of code with loops are counted with a line trace function
+// until the function is hot. It's only installed when there's no trace or profile function, and is
+// hidden from sys.gettrace() and from the frames this one calls, see PyJit_EvalFrameUncounted.
+static PyObject* PyJit_ExecuteColdFrame(PyjionJittedCode* state, PyFrameObject* frame, PyThreadState* tstate) {
+    state->j_hotness++;
+    if (state->j_backEdges == 0 || g_pyjionSettings.loopWeight == 0 || state->j_hotness >= state->j_threshold ||
+        tstate->c_tracefunc != nullptr || tstate->c_profilefunc != nullptr)
+        return _PyEval_EvalFrameDefault(tstate, frame, 0);
+
+    auto outer = t_backEdgeCounter;
+    t_backEdgeCounter = {state, frame, frame->f_lasti};
+    tstate->c_tracefunc = PyJit_CountBackEdge;
+    tstate->cframe->use_tracing = 1;
+    auto result = _PyEval_EvalFrameDefault(tstate, frame, 0);
+    // Unless the frame replaced it with a trace function of its own
+    if (tstate->c_tracefunc == PyJit_CountBackEdge)
+        tstate->c_tracefunc = nullptr;
+    tstate->cframe->use_tracing = tstate->c_tracefunc != nullptr || tstate->c_profilefunc != nullptr;
+    t_backEdgeCounter = outer;
+    return result;
+}
+
+// Evaluates a frame called by a cold frame which is counting its back edges. The frame is run without
+// the counting trace function, so it isn't traced and can run compiled code, then counting resumes.
+static PyObject* PyJit_EvalFrameUncounted(PyThreadState* tstate, PyFrameObject* frame, int throwflag) {
+    tstate->c_tracefunc = nullptr;
+    tstate->cframe->use_tracing = tstate->c_profilefunc != nullptr;
+    auto result = PyJit_EvalFrame(tstate, frame, throwflag);
+    if (tstate->c_tracefunc == nullptr) {
+        tstate->c_tracefunc = PyJit_CountBackEdge;
+        tstate->cframe->use_tracing = 1;
+    }
+    return result;
+}
+
+// Asynchronous counterpart of PyJit_ExecuteAndCompileFrame, the compile is handed to the
+// background queue and this frame runs in whatever is available right now.
+static PyObject* PyJit_ExecuteAndQueueFrame(PyjionJittedCode* state, PyFrameObject* frame, PyThreadState* tstate) {
+    CompileJob* job = nullptr;
+    if (!state->j_compilePending) {
+        if (g_compileQueue == nullptr)
+            g_compileQueue = new CompileQueue();
+        job = new CompileJob(state, frame);
+    }
+
+    PyObject* result;
+    if (state->j_addr != nullptr && state->j_pgcStatus == CompiledWithProbes) {
+        // Run the probed variant so the optimizing compile has a profile to work from.
+        result = PyJit_ExecuteJittedFrame((void*) state->j_addr, frame, tstate, state);
+    } else {
+        // Keep measuring, the queue compiles the hottest code first.
+        result = PyJit_ExecuteColdFrame(state, frame, tstate);
+    }
+
+    if (job != nullptr)
+        g_compileQueue->push(job);
+    return result;
+}
+
+// Run a frame whose arguments don't match the specialized variant.  The generic variant is
+// compiled on first use, until it's available (or if it can't be compiled) the frame is interpreted.
+static PyObject* PyJit_ExecuteGenericFrame(PyjionJittedCode* state, PyFrameObject* frame, PyThreadState* tstate) {
+    if (state->j_genericAddr != nullptr)
+        return PyJit_ExecuteJittedFrame((void*) state->j_genericAddr, frame, tstate, state);
+    if (!state->j_genericFailed && !state->j_compilePending) {
+        if (!PyJit_CompileInline()) {
+            if (g_compileQueue == nullptr)
+                g_compileQueue = new CompileQueue();
+            g_compileQueue->push(new CompileJob(state, frame, GenericVariant));
+        } else if (PyJit_CompileGeneric(state, frame->f_builtins, frame->f_globals)) {
+            return PyJit_ExecuteJittedFrame((void*) state->j_genericAddr, frame, tstate, state);
+        }
+    }
+    return _PyEval_EvalFrameDefault(tstate, frame, 0);
+}
+
+static inline bool PyJit_ArgumentsMatch(const AbstractValueKind* kinds, size_t kindsLen, PyFrameObject* frame, int argCount) {
+    if (argCount > kindsLen)
+        return true;
+    for (int i = 0; i < argCount; i++) {
+        if (frame->f_localsplus[i] != nullptr &&
+            kinds[i] != GetAbstractType(Py_TYPE(frame->f_localsplus[i]), frame->f_localsplus[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Run a frame whose arguments don't match the primary specialization. Look for a matching entry in the
+// specialization table, compiling a new one if there's room, otherwise fall back to the generic variant.
+static PyObject* PyJit_ExecuteSpecializedFrame(PyjionJittedCode* state, PyFrameObject* frame, PyThreadState* tstate, int argCount) {
+    for (auto& specialization : state->j_specializations) {
+        if (PyJit_ArgumentsMatch(specialization.kinds.data(), specialization.kinds.size(), frame, argCount)) {
+            specialization.lastUsed = state->j_runCount;
+            return PyJit_ExecuteJittedFrame((void*) specialization.addr, frame, tstate, state);
+        }
+    }
+    if (g_pyjionSettings.maxSpecializations > 0 && !state->j_megamorphic && !state->j_compilePending) {
+        if (!PyJit_CompileInline()) {
+            if (g_compileQueue == nullptr)
+                g_compileQueue = new CompileQueue();
+            g_compileQueue->push(new CompileJob(state, frame, SpecializationVariant));
+        } else {
+            auto addr = PyJit_CompileSpecialization(state, frame->f_builtins, frame->f_globals, frame->f_localsplus, argCount);
+            if (addr != nullptr)
+                return PyJit_ExecuteJittedFrame((void*) addr, frame, tstate, state);
+        }
+    }
+    return PyJit_ExecuteGenericFrame(state, frame, tstate);
+}
+
+// Jumps to an earlier instruction, the back edges of the loops in the code. Relative jumps only go forwards.
+// Cold frames of code without any aren't traced.
+static uint32_t PyJit_CountBackEdges(PyCodeObject* code) {
+    auto instructions = (_Py_CODEUNIT*) PyBytes_AS_STRING(code->co_code);
+    auto count = PyBytes_GET_SIZE(code->co_code) / sizeof(_Py_CODEUNIT);
+    uint32_t backEdges = 0;
+    int oparg = 0;
+    for (Py_ssize_t i = 0; i < count; i++) {
+        oparg = (oparg << 8) | _Py_OPARG(instructions[i]);
+        switch (_Py_OPCODE(instructions[i])) {
+            case EXTENDED_ARG:
+                continue;
+            case JUMP_ABSOLUTE:
+            case POP_JUMP_IF_FALSE:
+            case POP_JUMP_IF_TRUE:
+            case JUMP_IF_FALSE_OR_POP:
+            case JUMP_IF_TRUE_OR_POP:
+                if (oparg <= i)
+                    backEdges++;
+                break;
+        }
+        oparg = 0;
+    }
+    return backEdges;
+}
+
 PyjionJittedCode* PyJit_EnsureExtra(PyObject* codeObject) {
     auto index = (ssize_t) PyThread_tss_get(g_extraSlot);
     if (index == 0) {
@@ -357,37 +769,180 @@ PyjionJittedCode* PyJit_EnsureExtra(PyObject* codeObject) {
                 delete jitted;
                 return nullptr;
             }
+            jitted->j_backEdges = PyJit_CountBackEdges((PyCodeObject*) codeObject);
         }
     }
     return jitted;
 }
 
+// Called from probed code once a loop in the frame has run osrThreshold iterations. The frame
+// won't come back through PyJit_EvalFrame, so the code object is optimized here instead.
+int PyJit_PrepareOnStackReplace(PyFrameObject* frame, PyThreadState* tstate) {
+    auto state = PyJit_EnsureExtra((PyObject*) frame->f_code);
+    if (state == nullptr || state->j_failed || state->j_compilePending || tstate->cframe->use_tracing)
+        return 0;
+    int argCount = frame->f_code->co_argcount + frame->f_code->co_kwonlyargcount;
+    if (state->j_pgcStatus != Optimized) {
+        // The probes in this frame have already run, so the profile is complete
+        state->j_pgcStatus = CompiledWithProbes;
+        if (!PyJit_CompileInline()) {
+            // The frame keeps running the probed code and checks again after another osrThreshold iterations
+            if (g_compileQueue == nullptr)
+                g_compileQueue = new CompileQueue();
+            g_compileQueue->push(new CompileJob(state, frame));
+            return 0;
+        }
+        if (!PyJit_CompileCode(state, frame->f_builtins, frame->f_globals, frame->f_localsplus, argCount))
+            return 0;
+        state->j_pgcStatus = Optimized;
+    }
+    return state->j_osrEntries && PyJit_ArgumentsMatch(state->j_specializedKinds, state->j_specializedKindsLen, frame, argCount);
+}
+
+PyObject* PyJit_OnStackReplace(PyFrameObject* frame, PyThreadState* tstate) {
+    auto state = PyJit_EnsureExtra((PyObject*) frame->f_code);
+    g_pyjionStats.osrEntries++;
+    // As with a resumed generator, a suspended frame keeps its value stack for the entry point to load
+    frame->f_state = PY_FRAME_SUSPENDED;
+    return PyJit_ExecuteJittedFrame((void*) state->j_addr, frame, tstate, state);
+}
+
+void PyJit_RecordGuardFailure(PyFrameObject* frame) {
+    if (frame == nullptr)
+        return;
+    auto jitted = PyJit_EnsureExtra((PyObject*) frame->f_code);
+    if (jitted != nullptr && jitted->j_guardFailures < UINT32_MAX)
+        jitted->j_guardFailures++;
+}
+
+// Optimized code that keeps failing its guards was profiled against a workload that has
+// since changed. Each reprofile doubles the failures needed for the next one, and after
+// maxReprofiles the code object keeps whatever it has.
+static inline bool PyJit_ShouldReprofile(PyjionJittedCode* state) {
+    if (!PyJit_PgcEnabled() || g_pyjionSettings.reprofileThreshold == 0)
+        return false;
+    if (state->j_pgcStatus != Optimized || state->j_compilePending || state->j_reprofiles >= g_pyjionSettings.maxReprofiles)
+        return false;
+    // Past 32 doublings the limit is out of reach of the 32-bit failure count, and shifting further is undefined
+    if (state->j_reprofiles >= 32)
+        return false;
+    uint64_t limit = (uint64_t) g_pyjionSettings.reprofileThreshold << state->j_reprofiles;
+    return state->j_guardFailures >= limit;
+}
+
+static void PyJit_Reprofile(PyjionJittedCode* state) {
+    // Compiled code still running in other frames only holds the profile pointer, so clear it in place.
+    state->j_profile->clear();
+    state->j_pgcStatus = Uncompiled;
+    state->j_guardFailures = 0;
+    state->j_reprofiles++;
+    // Specializations were compiled from the old profile
+    state->j_specializations.clear();
+    state->j_specializationEvictions = 0;
+    state->j_megamorphic = false;
+    g_pyjionStats.reprofiles++;
+}
+
+// Glob match supporting * and ?, for module name patterns.
+static bool PyJit_GlobMatch(const char* pattern, const char* name) {
+    const char *star = nullptr, *resume = nullptr;
+    while (*name) {
+        if (*pattern == '?' || *pattern == *name) {
+            pattern++;
+            name++;
+        } else if (*pattern == '*') {
+            star = pattern++;
+            resume = name;
+        } else if (star != nullptr) {
+            pattern = star + 1;
+            name = ++resume;
+        } else {
+            return false;
+        }
+    }
+    while (*pattern == '*')
+        pattern++;
+    return *pattern == '\0';
+}
+
+static bool PyJit_MatchesAny(const vector<string>& patterns, const char* name) {
+    return std::any_of(patterns.begin(), patterns.end(), [name](const string& pattern) { return PyJit_GlobMatch(pattern.c_str(), name); });
+}
+
+// Code objects don't know their module, so the patterns are checked against the globals of the first frame.
+static void PyJit_CheckModulePolicy(PyjionJittedCode* state, PyObject* globals) {
+    state->j_policyChecked = true;
+    if (state->j_policyExplicit || (g_pyjionSettings.includeModules.empty() && g_pyjionSettings.excludeModules.empty()))
+        return;
+    PyObject* moduleName = PyDict_GetItemString(globals, "__name__");
+    const char* name = moduleName != nullptr && PyUnicode_Check(moduleName) ? PyUnicode_AsUTF8(moduleName) : nullptr;
+    if (name == nullptr) {
+        PyErr_Clear();
+        return;
+    }
+    if ((!g_pyjionSettings.includeModules.empty() && !PyJit_MatchesAny(g_pyjionSettings.includeModules, name)) ||
+        PyJit_MatchesAny(g_pyjionSettings.excludeModules, name)) {
+        state->j_failed = true;
+        state->j_compileResult = Excluded;
+    }
+}
+
 // This is our replacement evaluation function.  We lookup our corresponding jitted code
 // and dispatch to it if it's already compiled.  If it hasn't yet been compiled we'll
 // eventually compile it and invoke it.  If it's not time to compile it yet then we'll
 // invoke the default evaluation function.
 PyObject* PyJit_EvalFrame(PyThreadState* ts, PyFrameObject* f, int throwflag) {
+    if (ts->c_tracefunc == PyJit_CountBackEdge)
+        return PyJit_EvalFrameUncounted(ts, f, throwflag);
     auto jitted = PyJit_EnsureExtra((PyObject*) f->f_code);
     if (jitted != nullptr && !throwflag) {
-        if (jitted->j_addr != nullptr && jitted->j_genericAddr != nullptr &&
-            !jitted->j_failed && (!g_pyjionSettings.pgc || jitted->j_pgcStatus == Optimized)) {
+        CodePolicyScope policy(jitted);
+        if (!jitted->j_policyChecked)
+            PyJit_CheckModulePolicy(jitted, f->f_globals);
+        if (jitted->j_guardFailures != 0 && PyJit_ShouldReprofile(jitted))
+            PyJit_Reprofile(jitted);
+        if (jitted->j_addr != nullptr && !jitted->j_failed && PyJit_HooksActive(ts)) {
+            // None of the other variants call the hooks, so they're left for when the hooks are gone
+            jitted->j_runCount++;
+            return PyJit_ExecuteHooksFrame(jitted, f, ts);
+        }
+        if (jitted->j_addr != nullptr && !jitted->j_failed && (!PyJit_PgcEnabled() || jitted->j_pgcStatus == Optimized)) {
             jitted->j_runCount++;
 
             // Check specialized types.
             int argCount = f->f_code->co_argcount + f->f_code->co_kwonlyargcount;
-            for (int i = 0; i < argCount; i++) {
-                if (f->f_localsplus[i] != nullptr) {
-                    if (argCount <= jitted->j_specializedKindsLen &&
-                        jitted->j_specializedKinds[i] != GetAbstractType(Py_TYPE(f->f_localsplus[i]), f->f_localsplus[i])){
-                        return PyJit_ExecuteJittedFrame((void*) jitted->j_genericAddr, f, ts, jitted);
-                    }
-                }
+            if (!PyJit_ArgumentsMatch(jitted->j_specializedKinds, jitted->j_specializedKindsLen, f, argCount)) {
+                return PyJit_ExecuteSpecializedFrame(jitted, f, ts, argCount);
+            }
+            if (jitted->j_baseline && !jitted->j_compilePending && jitted->j_baselineRuns++ >= g_pyjionSettings.tierUpThreshold) {
+                if (PyJit_CompileInline())
+                    return PyJit_ExecuteAndCompileFrame(jitted, f, ts, jitted->j_profile);
+                if (g_compileQueue == nullptr)
+                    g_compileQueue = new CompileQueue();
+                // Keep running the baseline code until the optimized code is published
+                g_compileQueue->push(new CompileJob(jitted, f));
             }
 
             return PyJit_ExecuteJittedFrame((void*) jitted->j_addr, f, ts, jitted);
-        } else if (!jitted->j_failed && jitted->j_runCount++ >= jitted->j_threshold) {
+        } else if (!jitted->j_failed) {
+            jitted->j_runCount++;
+            if (jitted->j_hotness < jitted->j_threshold)
+                return PyJit_ExecuteColdFrame(jitted, f, ts);
+            if (jitted->j_pgcStatus == CompiledWithProbes && jitted->j_addr != nullptr && (jitted->j_probesPending || jitted->j_baselineRuns < g_pyjionSettings.tierUpThreshold)) {
+                // The probed variant is the baseline tier, it keeps profiling until the function has stayed hot.
+                int argCount = f->f_code->co_argcount + f->f_code->co_kwonlyargcount;
+                if (PyJit_ArgumentsMatch(jitted->j_specializedKinds, jitted->j_specializedKindsLen, f, argCount)) {
+                    jitted->j_probesPending = false;
+                    jitted->j_baselineRuns++;
+                    return PyJit_ExecuteJittedFrame((void*) jitted->j_addr, f, ts, jitted);
+                }
+            }
+            if (jitted->j_compilePending || !PyJit_CompileInline())
+                return PyJit_ExecuteAndQueueFrame(jitted, f, ts);
             auto result = PyJit_ExecuteAndCompileFrame(jitted, f, ts, jitted->j_profile);
-            jitted->j_pgcStatus = nextPgcStatus(jitted->j_pgcStatus);
+            // An on-stack replacement queued during the call steps the status when it's compiled
+            if (!jitted->j_compilePending)
+                jitted->j_pgcStatus = nextPgcStatus(jitted->j_pgcStatus);
             return result;
         }
     }
@@ -404,6 +959,7 @@ void PyjionJitFree(void* obj) {
     delete code_obj->j_profile;
     Py_XDECREF(code_obj->j_graph);
     Py_XDECREF(code_obj->j_genericGraph);
+    Py_CLEAR(code_obj->j_donor);
 }
 
 static PyInterpreterState* inter() {
@@ -450,12 +1006,26 @@ static PyObject* pyjion_info(PyObject* self, PyObject* func) {
     PyDict_SetItemString(res, "profiling", jitted->j_profilingHooks ? Py_True : Py_False);
     PyDict_SetItemString(res, "compile_result", PyLong_FromLong(jitted->j_compileResult));
     PyDict_SetItemString(res, "compiled", jitted->j_addr != nullptr ? Py_True : Py_False);
+    PyDict_SetItemString(res, "generic_compiled", jitted->j_genericAddr != nullptr ? Py_True : Py_False);
+    auto specializations = PyLong_FromSize_t(jitted->j_specializations.size());
+    PyDict_SetItemString(res, "specializations", specializations);
+    Py_DECREF(specializations);
+    auto guardFailures = PyLong_FromUnsignedLong(jitted->j_guardFailures);
+    PyDict_SetItemString(res, "guard_failures", guardFailures);
+    Py_DECREF(guardFailures);
+    auto reprofiles = PyLong_FromLong(jitted->j_reprofiles);
+    PyDict_SetItemString(res, "reprofiles", reprofiles);
+    Py_DECREF(reprofiles);
     PyDict_SetItemString(res, "optimizations", PyLong_FromLong(jitted->j_optimizations));
     PyDict_SetItemString(res, "pgc", PyLong_FromLong(jitted->j_pgcStatus));
+    PyDict_SetItemString(res, "baseline", jitted->j_baseline ? Py_True : Py_False);
 
     auto runCount = PyLong_FromUnsignedLongLong(jitted->j_runCount);
     PyDict_SetItemString(res, "run_count", runCount);
     Py_DECREF(runCount);
+    auto hotness = PyLong_FromUnsignedLongLong(jitted->j_hotness);
+    PyDict_SetItemString(res, "hotness", hotness);
+    Py_DECREF(hotness);
 
     return res;
 }
@@ -625,10 +1195,51 @@ static PyObject* pyjion_init(PyObject* self, PyObject* args) {
     }
 }
 
+static bool PyJit_ParsePatterns(PyObject* value, const char* name, vector<string>& patterns) {
+    if (!PyList_Check(value) && !PyTuple_Check(value)) {
+        PyErr_Format(PyExc_TypeError, "Expected list of str for %s", name);
+        return false;
+    }
+    vector<string> parsed;
+    auto items = PySequence_Fast(value, name);
+    if (items == nullptr)
+        return false;
+    for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(items); i++) {
+        auto item = PySequence_Fast_GET_ITEM(items, i);
+        const char* pattern = PyUnicode_Check(item) ? PyUnicode_AsUTF8(item) : nullptr;
+        if (pattern == nullptr) {
+            Py_DECREF(items);
+            if (!PyErr_Occurred())
+                PyErr_Format(PyExc_TypeError, "Expected list of str for %s", name);
+            return false;
+        }
+        parsed.emplace_back(pattern);
+    }
+    Py_DECREF(items);
+    patterns = parsed;
+    return true;
+}
+
+static PyObject* PyJit_PatternList(const vector<string>& patterns) {
+    auto res = PyList_New(0);
+    if (res == nullptr)
+        return nullptr;
+    for (auto& pattern : patterns) {
+        auto item = PyUnicode_FromString(pattern.c_str());
+        if (item == nullptr || PyList_Append(res, item) == -1) {
+            Py_XDECREF(item);
+            Py_DECREF(res);
+            return nullptr;
+        }
+        Py_DECREF(item);
+    }
+    return res;
+}
+
 static PyObject*
 pyjion_config(PyObject* self, PyObject* args, PyObject* kwargs) {
     Py_ssize_t nargs = PyTuple_GET_SIZE(args);
-    PyObject *pgc = nullptr, *level = nullptr, *debug = nullptr, *graph = nullptr, *threshold = nullptr;
+    PyObject *pgc = nullptr, *level = nullptr, *debug = nullptr, *graph = nullptr, *threshold = nullptr, *loopWeight = nullptr, *asyncCompile = nullptr, *lazyGeneric = nullptr, *maxSpecializations = nullptr, *reprofileThreshold = nullptr, *maxReprofiles = nullptr, *osrThreshold = nullptr, *tierUpThreshold = nullptr, *compileBudget = nullptr, *costModel = nullptr, *exceptionHandling = nullptr, *compileCacheSize = nullptr, *includeModules = nullptr, *excludeModules = nullptr;
     if (kwargs == nullptr) {
         goto return_result;
     }
@@ -694,13 +1305,185 @@ pyjion_config(PyObject* self, PyObject* args, PyObject* kwargs) {
             return nullptr;
         }
 
-        auto newThreshold = PyLong_AsLong(threshold);
-        if (newThreshold < 0 || newThreshold > MAX_UINT8_T) {
-            PyErr_SetString(PyExc_ValueError, "Threshold cannot be negative or exceed 255");
+        auto newThreshold = PyLong_AsLongLong(threshold);
+        if (newThreshold < 0 || newThreshold > UINT32_MAX) {
+            PyErr_SetString(PyExc_ValueError, "Threshold cannot be negative or exceed 4294967295");
             return nullptr;
         }
         g_pyjionSettings.threshold = newThreshold;
     }
+    loopWeight = PyDict_GetItemString(kwargs, "loop_weight");
+    if (loopWeight) {
+        // loop_weight
+        if (!PyLong_Check(loopWeight)) {
+            PyErr_SetString(PyExc_TypeError, "Expected int for loop_weight");
+            return nullptr;
+        }
+
+        auto newLoopWeight = PyLong_AsLongLong(loopWeight);
+        if (newLoopWeight < 0 || newLoopWeight > UINT32_MAX) {
+            PyErr_SetString(PyExc_ValueError, "loop_weight cannot be negative or exceed 4294967295");
+            return nullptr;
+        }
+        g_pyjionSettings.loopWeight = newLoopWeight;
+    }
+    asyncCompile = PyDict_GetItemString(kwargs, "async_compile");
+    if (asyncCompile) {
+        // async_compile
+        if (!PyBool_Check(asyncCompile)) {
+            PyErr_SetString(PyExc_TypeError, "Expected bool for async_compile flag");
+            return nullptr;
+        }
+        g_pyjionSettings.asyncCompile = asyncCompile == Py_True ? true : false;
+    }
+    lazyGeneric = PyDict_GetItemString(kwargs, "lazy_generic");
+    if (lazyGeneric) {
+        // lazy_generic
+        if (!PyBool_Check(lazyGeneric)) {
+            PyErr_SetString(PyExc_TypeError, "Expected bool for lazy_generic flag");
+            return nullptr;
+        }
+        g_pyjionSettings.lazyGeneric = lazyGeneric == Py_True ? true : false;
+    }
+    maxSpecializations = PyDict_GetItemString(kwargs, "max_specializations");
+    if (maxSpecializations) {
+        // max_specializations
+        if (!PyLong_Check(maxSpecializations)) {
+            PyErr_SetString(PyExc_TypeError, "Expected int for max_specializations");
+            return nullptr;
+        }
+
+        auto newMaxSpecializations = PyLong_AsLong(maxSpecializations);
+        if (newMaxSpecializations < 0 || newMaxSpecializations > MAX_UINT8_T) {
+            PyErr_SetString(PyExc_ValueError, "max_specializations cannot be negative or exceed 255");
+            return nullptr;
+        }
+        g_pyjionSettings.maxSpecializations = newMaxSpecializations;
+    }
+    reprofileThreshold = PyDict_GetItemString(kwargs, "reprofile_threshold");
+    if (reprofileThreshold) {
+        // reprofile_threshold
+        if (!PyLong_Check(reprofileThreshold)) {
+            PyErr_SetString(PyExc_TypeError, "Expected int for reprofile_threshold");
+            return nullptr;
+        }
+
+        auto newReprofileThreshold = PyLong_AsLongLong(reprofileThreshold);
+        if (newReprofileThreshold < 0 || newReprofileThreshold > UINT32_MAX) {
+            PyErr_SetString(PyExc_ValueError, "reprofile_threshold cannot be negative or exceed 4294967295");
+            return nullptr;
+        }
+        g_pyjionSettings.reprofileThreshold = newReprofileThreshold;
+    }
+    maxReprofiles = PyDict_GetItemString(kwargs, "max_reprofiles");
+    if (maxReprofiles) {
+        // max_reprofiles
+        if (!PyLong_Check(maxReprofiles)) {
+            PyErr_SetString(PyExc_TypeError, "Expected int for max_reprofiles");
+            return nullptr;
+        }
+
+        auto newMaxReprofiles = PyLong_AsLong(maxReprofiles);
+        if (newMaxReprofiles < 0 || newMaxReprofiles > MAX_UINT8_T) {
+            PyErr_SetString(PyExc_ValueError, "max_reprofiles cannot be negative or exceed 255");
+            return nullptr;
+        }
+        g_pyjionSettings.maxReprofiles = newMaxReprofiles;
+    }
+    osrThreshold = PyDict_GetItemString(kwargs, "osr_threshold");
+    if (osrThreshold) {
+        // osr_threshold
+        if (!PyLong_Check(osrThreshold)) {
+            PyErr_SetString(PyExc_TypeError, "Expected int for osr_threshold");
+            return nullptr;
+        }
+
+        auto newOsrThreshold = PyLong_AsLongLong(osrThreshold);
+        if (newOsrThreshold < 0 || newOsrThreshold > UINT32_MAX) {
+            PyErr_SetString(PyExc_ValueError, "osr_threshold cannot be negative or exceed 4294967295");
+            return nullptr;
+        }
+        g_pyjionSettings.osrThreshold = newOsrThreshold;
+    }
+    tierUpThreshold = PyDict_GetItemString(kwargs, "tier_up_threshold");
+    if (tierUpThreshold) {
+        // tier_up_threshold
+        if (!PyLong_Check(tierUpThreshold)) {
+            PyErr_SetString(PyExc_TypeError, "Expected int for tier_up_threshold");
+            return nullptr;
+        }
+
+        auto newTierUpThreshold = PyLong_AsLongLong(tierUpThreshold);
+        if (newTierUpThreshold < 0 || newTierUpThreshold > UINT32_MAX) {
+            PyErr_SetString(PyExc_ValueError, "tier_up_threshold cannot be negative or exceed 4294967295");
+            return nullptr;
+        }
+        g_pyjionSettings.tierUpThreshold = newTierUpThreshold;
+    }
+    compileBudget = PyDict_GetItemString(kwargs, "compile_budget_ms_per_sec");
+    if (compileBudget) {
+        // compile_budget_ms_per_sec
+        if (!PyLong_Check(compileBudget)) {
+            PyErr_SetString(PyExc_TypeError, "Expected int for compile_budget_ms_per_sec");
+            return nullptr;
+        }
+
+        auto newCompileBudget = PyLong_AsLong(compileBudget);
+        if (newCompileBudget < 0 || newCompileBudget > 1000) {
+            PyErr_SetString(PyExc_ValueError, "compile_budget_ms_per_sec cannot be negative or exceed 1000");
+            return nullptr;
+        }
+        if (g_pyjionSettings.compileBudget != newCompileBudget) {
+            g_pyjionSettings.compileBudget = newCompileBudget;
+            g_compileBudget.reset();
+        }
+    }
+    costModel = PyDict_GetItemString(kwargs, "cost_model");
+    if (costModel) {
+        // cost_model
+        if (!PyBool_Check(costModel)) {
+            PyErr_SetString(PyExc_TypeError, "Expected bool for cost_model");
+            return nullptr;
+        }
+        g_pyjionSettings.costModel = costModel == Py_True;
+    }
+    exceptionHandling = PyDict_GetItemString(kwargs, "exception_handling");
+    if (exceptionHandling) {
+        // exception_handling
+        if (!PyBool_Check(exceptionHandling)) {
+            PyErr_SetString(PyExc_TypeError, "Expected bool for exception_handling");
+            return nullptr;
+        }
+        g_pyjionSettings.exceptionHandling = exceptionHandling == Py_True;
+    }
+    compileCacheSize = PyDict_GetItemString(kwargs, "compile_cache_size");
+    if (compileCacheSize) {
+        // compile_cache_size
+        if (!PyLong_Check(compileCacheSize)) {
+            PyErr_SetString(PyExc_TypeError, "Expected int for compile_cache_size");
+            return nullptr;
+        }
+
+        auto newCompileCacheSize = PyLong_AsLong(compileCacheSize);
+        if (newCompileCacheSize < 0 || newCompileCacheSize > UINT16_MAX) {
+            PyErr_SetString(PyExc_ValueError, "compile_cache_size cannot be negative or exceed 65535");
+            return nullptr;
+        }
+        g_pyjionSettings.compileCacheSize = newCompileCacheSize;
+        g_compileCache.trim(newCompileCacheSize);
+    }
+    includeModules = PyDict_GetItemString(kwargs, "include_modules");
+    if (includeModules) {
+        // include_modules
+        if (!PyJit_ParsePatterns(includeModules, "include_modules", g_pyjionSettings.includeModules))
+            return nullptr;
+    }
+    excludeModules = PyDict_GetItemString(kwargs, "exclude_modules");
+    if (excludeModules) {
+        // exclude_modules
+        if (!PyJit_ParsePatterns(excludeModules, "exclude_modules", g_pyjionSettings.excludeModules))
+            return nullptr;
+    }
 
 return_result:
     auto res = PyDict_New();
@@ -723,11 +1506,342 @@ return_result:
             break;
     }
     PyDict_SetItemString(res, "level", PyLong_FromLong(g_pyjionSettings.optimizationLevel));
-    PyDict_SetItemString(res, "threshold", PyLong_FromLong(g_pyjionSettings.threshold));
+    PyDict_SetItemString(res, "threshold", PyLong_FromUnsignedLong(g_pyjionSettings.threshold));
+    PyDict_SetItemString(res, "loop_weight", PyLong_FromUnsignedLong(g_pyjionSettings.loopWeight));
+    PyDict_SetItemString(res, "async_compile", g_pyjionSettings.asyncCompile ? Py_True : Py_False);
+    PyDict_SetItemString(res, "lazy_generic", g_pyjionSettings.lazyGeneric ? Py_True : Py_False);
+    PyDict_SetItemString(res, "max_specializations", PyLong_FromLong(g_pyjionSettings.maxSpecializations));
+    PyDict_SetItemString(res, "reprofile_threshold", PyLong_FromUnsignedLong(g_pyjionSettings.reprofileThreshold));
+    PyDict_SetItemString(res, "max_reprofiles", PyLong_FromLong(g_pyjionSettings.maxReprofiles));
+    PyDict_SetItemString(res, "osr_threshold", PyLong_FromUnsignedLong(g_pyjionSettings.osrThreshold));
+    PyDict_SetItemString(res, "tier_up_threshold", PyLong_FromUnsignedLong(g_pyjionSettings.tierUpThreshold));
+    PyDict_SetItemString(res, "compile_budget_ms_per_sec", PyLong_FromLong(g_pyjionSettings.compileBudget));
+    PyDict_SetItemString(res, "cost_model", g_pyjionSettings.costModel ? Py_True : Py_False);
+    PyDict_SetItemString(res, "exception_handling", g_pyjionSettings.exceptionHandling ? Py_True : Py_False);
+    PyDict_SetItemString(res, "compile_cache_size", PyLong_FromLong(g_pyjionSettings.compileCacheSize));
+    auto includeList = PyJit_PatternList(g_pyjionSettings.includeModules);
+    if (includeList != nullptr) {
+        PyDict_SetItemString(res, "include_modules", includeList);
+        Py_DECREF(includeList);
+    }
+    auto excludeList = PyJit_PatternList(g_pyjionSettings.excludeModules);
+    if (excludeList != nullptr) {
+        PyDict_SetItemString(res, "exclude_modules", excludeList);
+        Py_DECREF(excludeList);
+    }
 
     return res;
 }
 
+static PyObject* pyjion_stats(PyObject* self, PyObject* args) {
+    auto res = PyDict_New();
+    if (res == nullptr) {
+        return nullptr;
+    }
+
+    auto compiled = PyLong_FromUnsignedLongLong(g_pyjionStats.compiled);
+    PyDict_SetItemString(res, "compiled", compiled);
+    Py_DECREF(compiled);
+    auto genericCompiled = PyLong_FromUnsignedLongLong(g_pyjionStats.genericCompiled);
+    PyDict_SetItemString(res, "generic_compiled", genericCompiled);
+    Py_DECREF(genericCompiled);
+    // Functions that have only ever been called with their specialized argument kinds
+    auto genericSkipped = PyLong_FromUnsignedLongLong(g_pyjionStats.compiled - std::min(g_pyjionStats.genericCompiled, g_pyjionStats.compiled));
+    PyDict_SetItemString(res, "generic_skipped", genericSkipped);
+    Py_DECREF(genericSkipped);
+    auto specializations = PyLong_FromUnsignedLongLong(g_pyjionStats.specializations);
+    PyDict_SetItemString(res, "specializations", specializations);
+    Py_DECREF(specializations);
+    auto deoptimizations = PyLong_FromUnsignedLongLong(g_pyjionStats.deoptimizations);
+    PyDict_SetItemString(res, "deoptimizations", deoptimizations);
+    Py_DECREF(deoptimizations);
+    auto reprofiles = PyLong_FromUnsignedLongLong(g_pyjionStats.reprofiles);
+    PyDict_SetItemString(res, "reprofiles", reprofiles);
+    Py_DECREF(reprofiles);
+    auto osrEntries = PyLong_FromUnsignedLongLong(g_pyjionStats.osrEntries);
+    PyDict_SetItemString(res, "osr_entries", osrEntries);
+    Py_DECREF(osrEntries);
+    auto tierUps = PyLong_FromUnsignedLongLong(g_pyjionStats.tierUps);
+    PyDict_SetItemString(res, "tier_ups", tierUps);
+    Py_DECREF(tierUps);
+    auto compileTime = PyLong_FromUnsignedLongLong(g_pyjionStats.compileMicroseconds);
+    PyDict_SetItemString(res, "compile_time_us", compileTime);
+    Py_DECREF(compileTime);
+    auto deferredCompiles = PyLong_FromUnsignedLongLong(g_pyjionStats.deferredCompiles);
+    PyDict_SetItemString(res, "deferred_compiles", deferredCompiles);
+    Py_DECREF(deferredCompiles);
+    auto cacheHits = PyLong_FromUnsignedLongLong(g_pyjionStats.cacheHits);
+    PyDict_SetItemString(res, "cache_hits", cacheHits);
+    Py_DECREF(cacheHits);
+    auto cacheMisses = PyLong_FromUnsignedLongLong(g_pyjionStats.cacheMisses);
+    PyDict_SetItemString(res, "cache_misses", cacheMisses);
+    Py_DECREF(cacheMisses);
+    auto profilesLoaded = PyLong_FromUnsignedLongLong(g_pyjionStats.profilesLoaded);
+    PyDict_SetItemString(res, "profiles_loaded", profilesLoaded);
+    Py_DECREF(profilesLoaded);
+    auto regionExits = PyLong_FromUnsignedLongLong(g_pyjionStats.regionExits);
+    PyDict_SetItemString(res, "region_exits", regionExits);
+    Py_DECREF(regionExits);
+    auto hooksCompiled = PyLong_FromUnsignedLongLong(g_pyjionStats.hooksCompiled);
+    PyDict_SetItemString(res, "hooks_compiled", hooksCompiled);
+    Py_DECREF(hooksCompiled);
+    auto codeHeap = g_codeHeap.statistics();
+    auto codeHeapReserved = PyLong_FromSize_t(codeHeap.reserved);
+    PyDict_SetItemString(res, "code_heap_reserved", codeHeapReserved);
+    Py_DECREF(codeHeapReserved);
+    auto codeHeapUsed = PyLong_FromSize_t(codeHeap.used);
+    PyDict_SetItemString(res, "code_heap_used", codeHeapUsed);
+    Py_DECREF(codeHeapUsed);
+    auto codeHeapFree = PyLong_FromSize_t(codeHeap.free);
+    PyDict_SetItemString(res, "code_heap_free", codeHeapFree);
+    Py_DECREF(codeHeapFree);
+    auto codeHeapChunks = PyLong_FromSize_t(codeHeap.chunks + codeHeap.largeBlocks);
+    PyDict_SetItemString(res, "code_heap_mappings", codeHeapChunks);
+    Py_DECREF(codeHeapChunks);
+
+    return res;
+}
+
+static PyObject* pyjion_precompile(PyObject* self, PyObject* args) {
+    PyObject *code, *globals, *arguments;
+    if (!PyArg_ParseTuple(args, "O!O!O!", &PyCode_Type, &code, &PyDict_Type, &globals, &PyTuple_Type, &arguments))
+        return nullptr;
+    auto state = PyJit_EnsureExtra(code);
+    if (state == nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "Failed to allocate the Pyjion state for the code object");
+        return nullptr;
+    }
+    if (state->j_addr != nullptr)
+        Py_RETURN_TRUE;
+    if (!state->j_policyChecked)
+        PyJit_CheckModulePolicy(state, globals);
+    if (state->j_failed || state->j_compilePending)
+        Py_RETURN_FALSE;
+
+    PyObject* builtins = PyDict_GetItemString(globals, "__builtins__");
+    if (builtins != nullptr && PyModule_Check(builtins))
+        builtins = PyModule_GetDict(builtins);
+    if (builtins == nullptr || !PyDict_Check(builtins))
+        builtins = PyEval_GetBuiltins();
+
+    // Without example arguments there are no specialized kinds, so the code is compiled for any argument types
+    auto codeObject = (PyCodeObject*) code;
+    int argCount = (int) PyTuple_GET_SIZE(arguments);
+    if (argCount != 0 && argCount != codeObject->co_argcount + codeObject->co_kwonlyargcount) {
+        PyErr_SetString(PyExc_ValueError, "Expected an example for every argument");
+        return nullptr;
+    }
+    vector<PyObject*> locals(argCount, nullptr);
+    for (int i = 0; i < argCount; i++)
+        locals[i] = PyTuple_GET_ITEM(arguments, i);
+
+    CodePolicyScope policy(state);
+    // Code which is precompiled is expected to be hot
+    state->j_hotness = std::max(state->j_hotness, (PY_UINT64_T) state->j_threshold);
+    bool compiled = PyJit_CompileCode(state, builtins, globals, locals.data(), argCount);
+    if (compiled && PyJit_PgcEnabled() && state->j_pgcStatus == Uncompiled) {
+        // Without a profile this is the probed variant, let the first call run it
+        state->j_probesPending = true;
+    }
+    state->j_pgcStatus = nextPgcStatus(state->j_pgcStatus);
+    if (compiled)
+        Py_RETURN_TRUE;
+    Py_RETURN_FALSE;
+}
+
+static PyObject* pyjion_set_policy(PyObject* self, PyObject* args) {
+    PyObject *code, *level, *pgc, *threshold;
+    if (!PyArg_ParseTuple(args, "O!OOO", &PyCode_Type, &code, &level, &pgc, &threshold))
+        return nullptr;
+    if (level != Py_None && !PyLong_Check(level)) {
+        PyErr_SetString(PyExc_TypeError, "Expected int for optimization level");
+        return nullptr;
+    }
+    if (pgc != Py_None && !PyBool_Check(pgc)) {
+        PyErr_SetString(PyExc_TypeError, "Expected bool for pgc flag");
+        return nullptr;
+    }
+    if (threshold != Py_None && !PyLong_Check(threshold)) {
+        PyErr_SetString(PyExc_TypeError, "Expected int for threshold");
+        return nullptr;
+    }
+    long newLevel = level == Py_None ? -1 : PyLong_AsLong(level);
+    if (level != Py_None && (newLevel < 0 || newLevel > 2)) {
+        PyErr_SetString(PyExc_ValueError, "Level not in range of 0-2");
+        return nullptr;
+    }
+    long long newThreshold = threshold == Py_None ? -1 : PyLong_AsLongLong(threshold);
+    if (threshold != Py_None && (newThreshold < 0 || newThreshold > UINT32_MAX)) {
+        PyErr_SetString(PyExc_ValueError, "threshold cannot be negative or exceed 4294967295");
+        return nullptr;
+    }
+
+    auto state = PyJit_EnsureExtra(code);
+    if (state == nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "Failed to allocate the Pyjion state for the code object");
+        return nullptr;
+    }
+    state->j_policy.level = (int16_t) newLevel;
+    state->j_policy.optimizations = newLevel == -1 ? OptimizationFlags() : optimizationsForLevel(newLevel);
+    state->j_policy.pgc = pgc == Py_None ? -1 : (pgc == Py_True ? 1 : 0);
+    if (newThreshold != -1)
+        state->j_threshold = (uint32_t) newThreshold;
+    state->j_policyExplicit = true;
+    if (state->j_failed && state->j_compileResult == Excluded) {
+        state->j_failed = false;
+        state->j_compileResult = NoResult;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* pyjion_exclude(PyObject* self, PyObject* code) {
+    if (!PyCode_Check(code)) {
+        PyErr_SetString(PyExc_TypeError, "Expected code object");
+        return nullptr;
+    }
+    auto state = PyJit_EnsureExtra(code);
+    if (state == nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "Failed to allocate the Pyjion state for the code object");
+        return nullptr;
+    }
+    // Code which is already compiled keeps running in the interpreter from now on
+    state->j_failed = true;
+    state->j_compileResult = Excluded;
+    state->j_policyExplicit = true;
+    Py_RETURN_NONE;
+}
+
+static PyObject* pyjion_profiles(PyObject* self, PyObject* args) {
+    auto res = PyDict_New();
+    if (res == nullptr)
+        return nullptr;
+    for (auto& profile : g_savedProfiles) {
+        auto entries = PyList_New(0);
+        auto key = PyLong_FromUnsignedLongLong(profile.first);
+        if (entries == nullptr || key == nullptr || PyDict_SetItem(res, key, entries) == -1) {
+            Py_XDECREF(entries);
+            Py_XDECREF(key);
+            Py_DECREF(res);
+            return nullptr;
+        }
+        Py_DECREF(key);
+        Py_DECREF(entries);
+        for (auto& entry : profile.second) {
+            auto item = Py_BuildValue("[nnsi]", entry.first.first, entry.first.second, entry.second.type.c_str(), (int) entry.second.kind);
+            if (item == nullptr || PyList_Append(entries, item) == -1) {
+                Py_XDECREF(item);
+                Py_DECREF(res);
+                return nullptr;
+            }
+            Py_DECREF(item);
+        }
+    }
+    return res;
+}
+
+static PyObject* pyjion_load_profiles(PyObject* self, PyObject* profiles) {
+    if (!PyDict_Check(profiles)) {
+        PyErr_SetString(PyExc_TypeError, "Expected dict of profiles");
+        return nullptr;
+    }
+    PyObject *key, *entries;
+    Py_ssize_t pos = 0;
+    while (PyDict_Next(profiles, &pos, &key, &entries)) {
+        if (!PyLong_Check(key) || !PyList_Check(entries)) {
+            PyErr_SetString(PyExc_TypeError, "Expected int keys and list entries");
+            return nullptr;
+        }
+        auto codeKey = PyLong_AsUnsignedLongLong(key);
+        if (PyErr_Occurred())
+            return nullptr;
+        SavedProfile profile;
+        for (Py_ssize_t i = 0; i < PyList_GET_SIZE(entries); i++) {
+            Py_ssize_t opcodePosition, stackPosition;
+            const char* type;
+            int kind;
+            auto entry = PyList_GET_ITEM(entries, i);
+            if (!PyList_Check(entry) && !PyTuple_Check(entry)) {
+                PyErr_SetString(PyExc_TypeError, "Expected [opcode position, stack position, type, kind] entries");
+                return nullptr;
+            }
+            auto args = PySequence_Tuple(entry);
+            if (args == nullptr)
+                return nullptr;
+            bool parsed = PyArg_ParseTuple(args, "nnsi", &opcodePosition, &stackPosition, &type, &kind);
+            if (parsed && (opcodePosition < 0 || stackPosition < 0 || kind < 0 || kind > AVK_UnboxedRangeIterator)) {
+                PyErr_SetString(PyExc_ValueError, "Profile positions cannot be negative and kinds must be an AbstractValueKind");
+                parsed = false;
+            }
+            if (parsed)
+                profile[{opcodePosition, stackPosition}] = SavedProfileEntry{type, (AbstractValueKind) kind};
+            Py_DECREF(args);
+            if (!parsed)
+                return nullptr;
+        }
+        mergeSavedProfile(codeKey, profile);
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* pyjion_clear_profiles(PyObject* self, PyObject* args) {
+    g_savedProfiles.clear();
+    Py_RETURN_NONE;
+}
+
+static PyObject* pyjion_drain(PyObject* self, PyObject* args) {
+    if (g_compileQueue != nullptr)
+        g_compileQueue->drain();
+    Py_RETURN_NONE;
+}
+
+static PyObject* pyjion_before_fork(PyObject* self, PyObject* args) {
+    // Finish queued compiles so forked workers share the code instead of each compiling it, then stop
+    // reusing memory in chunks the child will share.
+    if (g_compileQueue != nullptr)
+        g_compileQueue->drain();
+    g_codeHeap.freeze();
+    Py_RETURN_NONE;
+}
+
+static PyObject* pyjion_after_fork_child(PyObject* self, PyObject* args) {
+    // Only the forking thread exists in the child. The queue and pool still reference their parent's
+    // worker threads, so they're abandoned rather than stopped and new ones start when they're needed.
+    if (g_compileQueue != nullptr)
+        g_compileQueue->abandon();
+    g_compileQueue = nullptr;
+    g_jitPool = nullptr;
+    Py_RETURN_NONE;
+}
+
+// For testing the code heap, the blocks are (rx, rw, size) tuples and never executed.
+static PyObject* pyjion_code_heap_allocate(PyObject* self, PyObject* size) {
+    size_t bytes = PyLong_AsSize_t(size);
+    if (bytes == (size_t) -1 && PyErr_Occurred())
+        return nullptr;
+    auto block = g_codeHeap.allocate(bytes);
+    if (block.rx == nullptr)
+        return PyErr_NoMemory();
+    return Py_BuildValue("(KKn)", (unsigned long long) block.rx, (unsigned long long) block.rw, (Py_ssize_t) block.size);
+}
+
+static PyObject* pyjion_code_heap_release(PyObject* self, PyObject* args) {
+    unsigned long long rx, rw;
+    Py_ssize_t size;
+    if (!PyArg_ParseTuple(args, "(KKn)", &rx, &rw, &size))
+        return nullptr;
+    g_codeHeap.release({(uint8_t*) rx, (uint8_t*) rw, (size_t) size});
+    Py_RETURN_NONE;
+}
+
+static PyObject* pyjion_shutdown(PyObject* self, PyObject* args) {
+    if (g_compileQueue != nullptr)
+        g_compileQueue->shutdown();
+    if (g_jitPool != nullptr)
+        g_jitPool->shutdown();
+    g_compileCache.clear();
+    Py_RETURN_NONE;
+}
+
 static PyMethodDef PyjionMethods[] = {
         {"enable",
          pyjion_enable,
@@ -771,6 +1885,58 @@ static PyMethodDef PyjionMethods[] = {
          "Return a list of global symbols."
 
         },
+        {"stats",
+         pyjion_stats,
+         METH_NOARGS,
+         "Returns a dictionary of global compilation counters."},
+        {"drain",
+         pyjion_drain,
+         METH_NOARGS,
+         "Wait for all queued background compilations to finish."},
+        {"precompile",
+         pyjion_precompile,
+         METH_VARARGS,
+         "Compile a code object ahead of its first call, with example arguments to specialize it for."},
+        {"set_policy",
+         pyjion_set_policy,
+         METH_VARARGS,
+         "Override the optimization level, PGC and threshold for a code object, None keeps the global setting."},
+        {"exclude",
+         pyjion_exclude,
+         METH_O,
+         "Never compile the code object."},
+        {"profiles",
+         pyjion_profiles,
+         METH_NOARGS,
+         "Return the saved PGC profiles by stable code key."},
+        {"load_profiles",
+         pyjion_load_profiles,
+         METH_O,
+         "Merge PGC profiles by stable code key, code objects with a profile are compiled optimized on first heat-up."},
+        {"clear_profiles",
+         pyjion_clear_profiles,
+         METH_NOARGS,
+         "Forget the saved and loaded PGC profiles."},
+        {"before_fork",
+         pyjion_before_fork,
+         METH_NOARGS,
+         "Finish queued compilations and stop reusing code memory which will be shared with the child process."},
+        {"after_fork_child",
+         pyjion_after_fork_child,
+         METH_NOARGS,
+         "Reset the background compiler in a forked child process."},
+        {"code_heap_allocate",
+         pyjion_code_heap_allocate,
+         METH_O,
+         "Allocate a block from the code heap, for testing."},
+        {"code_heap_release",
+         pyjion_code_heap_release,
+         METH_VARARGS,
+         "Release a block allocated by code_heap_allocate, for testing."},
+        {"shutdown",
+         pyjion_shutdown,
+         METH_NOARGS,
+         "Stop the background compiler thread, discarding any queued compilations."},
         {nullptr, nullptr, 0, nullptr} /* Sentinel */
 };
 
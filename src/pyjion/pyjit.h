@@ -36,6 +36,8 @@
 #include <cfloat>
 
 #include <vector>
+#include <map>
+#include <string>
 #include <unordered_map>
 
 #include <Python.h>
@@ -67,6 +69,14 @@ enum OptimizationFlags {
     OptimisticIntegers = 32768
 };
 
+/* A profile which can outlive the process that recorded it, types are held by qualified name.
+ * An empty type name marks a position where merged profiles disagree. */
+struct SavedProfileEntry {
+    string type;
+    AbstractValueKind kind;
+};
+typedef map<pair<size_t, size_t>, SavedProfileEntry> SavedProfile;
+
 class PyjionCodeProfile : public PyjionBase {
     unordered_map<size_t, unordered_map<size_t, PyTypeObject*>> stackTypes;
     unordered_map<size_t, unordered_map<size_t, AbstractValueKind>> stackKinds;
@@ -75,18 +85,34 @@ public:
     void record(size_t opcodePosition, size_t stackPosition, PyObject* obj);
     PyTypeObject* getType(size_t opcodePosition, size_t stackPosition);
     AbstractValueKind getKind(size_t opcodePosition, size_t stackPosition);
+    // True when the instruction has been profiled and none of its operands had a type Pyjion specializes for.
+    bool onlyObjects(size_t opcodePosition);
+    void clear();
+    SavedProfile save();
+    // Fill the profile from a saved one, returns the number of positions whose type could be resolved.
+    size_t load(const SavedProfile& saved);
     ~PyjionCodeProfile();
 };
 
+// Saved profiles by stable code key, from this process and from pyjion.load_profiles()
+extern unordered_map<uint64_t, SavedProfile> g_savedProfiles;
+// Merge a profile into g_savedProfiles, positions observed with different types are marked as conflicting.
+void mergeSavedProfile(uint64_t key, const SavedProfile& profile);
+uint64_t PyJit_StableCodeKey(PyCodeObject* code);
+
 void capturePgcStackValue(PyjionCodeProfile* profile, PyObject* value, size_t opcodePosition, size_t stackPosition);
 class PyjionJittedCode;
 
 bool JitInit(const wchar_t* jitpath);
 PyObject* PyJit_ExecuteAndCompileFrame(PyjionJittedCode* state, PyFrameObject* frame, PyThreadState* tstate, PyjionCodeProfile* profile);
+bool PyJit_CompileCode(PyjionJittedCode* state, PyObject* builtins, PyObject* globals, PyObject** args, int argCount);
+bool PyJit_CompileGeneric(PyjionJittedCode* state, PyObject* builtins, PyObject* globals);
+bool PyJit_CompileHooks(PyjionJittedCode* state, PyObject* builtins, PyObject* globals);
 static inline PyObject* PyJit_CheckFunctionResult(PyThreadState* tstate, PyObject* result, PyFrameObject* frame);
 static inline PyObject* PyJit_ExecuteJittedFrame(void* state, PyFrameObject* frame, PyThreadState* tstate, PyjionJittedCode*);
 PyObject* PyJit_EvalFrame(PyThreadState*, PyFrameObject*, int);
 PyjionJittedCode* PyJit_EnsureExtra(PyObject* codeObject);
+void PyJit_RecordGuardFailure(PyFrameObject* frame);
 
 // This type isn't exported in the Python 3.10 API, so define it here.
 typedef struct {
@@ -97,6 +123,10 @@ typedef struct {
 
 typedef PyObject* (*Py_EvalFunc)(PyjionJittedCode*, struct _frame*, PyThreadState*, PyjionCodeProfile*, PyTraceInfo*);
 
+Py_EvalFunc PyJit_CompileSpecialization(PyjionJittedCode* state, PyObject* builtins, PyObject* globals, PyObject** args, int argCount);
+int PyJit_PrepareOnStackReplace(PyFrameObject* frame, PyThreadState* tstate);
+PyObject* PyJit_OnStackReplace(PyFrameObject* frame, PyThreadState* tstate);
+
 
 inline OptimizationFlags operator|(OptimizationFlags a, OptimizationFlags b) {
     return static_cast<OptimizationFlags>(static_cast<int>(a) | static_cast<int>(b));
@@ -109,7 +139,8 @@ typedef struct PyjionSettings {
     bool pgc = true;   // Profile-guided-compilation
     bool graph = false;// Generate instruction graphs
     uint8_t optimizationLevel = 1;
-    uint8_t threshold = 0;
+    uint32_t threshold = 0; // Hotness a function needs before it's compiled
+    uint32_t loopWeight = 100;// Hotness per back edge taken by a frame running in the interpreter
     uint32_t recursionLimit = DEFAULT_RECURSION_LIMIT;
     uint32_t codeObjectSizeLimit = DEFAULT_CODEOBJECT_SIZE_LIMIT;
 #ifdef DEBUG
@@ -117,7 +148,19 @@ typedef struct PyjionSettings {
 #else
     DebugMode debug = DebugMode::Release;
 #endif
-    bool exceptionHandling = false;
+    bool exceptionHandling = true;// Compile functions with try/except/finally blocks
+    bool asyncCompile = false;// Compile hot code on a background thread
+    bool lazyGeneric = true;  // Only compile the generic variant on the first specialization miss
+    uint8_t maxSpecializations = 4;// Extra specialized variants per code object, 0 to disable
+    uint32_t reprofileThreshold = 100;// Guard failures before optimized code is profiled again, 0 to disable
+    uint8_t maxReprofiles = 3;       // Reprofiles per code object, each doubling the threshold
+    uint32_t osrThreshold = 1000;    // Loop iterations before a probed frame moves into optimized code, 0 to disable
+    uint32_t tierUpThreshold = 0;    // Calls run in baseline (MIN_OPT) code before the fully optimized compile
+    uint16_t compileBudget = 0;      // Milliseconds of compile time per second before compiles are deferred, 0 for no limit
+    bool costModel = false;          // Skip functions dominated by calls
+    vector<string> includeModules;   // Module name patterns to compile, empty for all
+    vector<string> excludeModules;   // Module name patterns never to compile
+    uint16_t compileCacheSize = 256; // Compiled code objects kept for reuse by identical code objects, 0 to disable
     const wchar_t* clrjitpath = L"";
 
     // Optimizations
@@ -125,9 +168,52 @@ typedef struct PyjionSettings {
 } PyjionSettings;
 
 extern PyjionSettings g_pyjionSettings;
+
+/* Overrides of the global settings for one code object, set by the @pyjion.jit decorator. */
+struct PyjionCodePolicy {
+    int16_t level = -1;// Optimization level, -1 for the global level
+    OptimizationFlags optimizations = OptimizationFlags();
+    int8_t pgc = -1;   // Profile-guided compilation, -1 for the global setting
+
+    bool active() const {
+        return level != -1 || pgc != -1;
+    }
+};
+
+// Policy of the code object the current thread is compiling or running
+extern thread_local PyjionCodePolicy t_compilePolicy;
+
+inline OptimizationFlags PyJit_Optimizations() {
+    return t_compilePolicy.level == -1 ? g_pyjionSettings.optimizations : t_compilePolicy.optimizations;
+}
+inline uint8_t PyJit_OptimizationLevel() {
+    return t_compilePolicy.level == -1 ? g_pyjionSettings.optimizationLevel : (uint8_t) t_compilePolicy.level;
+}
+inline bool PyJit_PgcEnabled() {
+    return t_compilePolicy.pgc == -1 ? g_pyjionSettings.pgc : t_compilePolicy.pgc == 1;
+}
+
+typedef struct PyjionStatistics {
+    uint64_t compiled = 0;       // Code objects with a compiled (specialized) body
+    uint64_t genericCompiled = 0;// Of those, how many also needed a generic body
+    uint64_t specializations = 0;// Entries compiled into specialization tables
+    uint64_t deoptimizations = 0;// Frames handed back to the interpreter on a failed guard
+    uint64_t reprofiles = 0;     // Optimized code objects sent back through profiling
+    uint64_t osrEntries = 0;     // Running frames moved into optimized code at a loop header
+    uint64_t tierUps = 0;        // Baseline code objects recompiled with full optimization
+    uint64_t compileMicroseconds = 0;// Time spent compiling
+    uint64_t deferredCompiles = 0;   // Compiles sent to the background queue by the compile budget
+    uint64_t cacheHits = 0;          // Compiles served from the compile cache
+    uint64_t cacheMisses = 0;        // Cacheable compiles which weren't in it
+    uint64_t profilesLoaded = 0;     // Code objects which started with a saved PGC profile
+    uint64_t regionExits = 0;        // Frames of oversized functions handed to the interpreter at the end of their compiled region
+    uint64_t hooksCompiled = 0;      // Code objects which needed a variant with tracing and profiling hooks
+} PyjionStatistics;
+
+extern PyjionStatistics g_pyjionStats;
 extern AttributeTable* g_attrTable;
 
-#define OPT_ENABLED(opt) ((g_pyjionSettings.optimizations & (opt)) == (opt))
+#define OPT_ENABLED(opt) ((PyJit_Optimizations() & (opt)) == (opt))
 void PyjionJitFree(void* obj);
 
 int Pyjit_CheckRecursiveCall(PyThreadState* tstate, const char* where);
@@ -145,6 +231,14 @@ enum PgcStatus {
 
 PgcStatus nextPgcStatus(PgcStatus status);
 
+/* An additional specialized entry point, for calls whose argument kinds don't match the primary one. */
+class PyjionSpecialization {
+public:
+    vector<AbstractValueKind> kinds;
+    Py_EvalFunc addr;
+    PY_UINT64_T lastUsed;// Value of j_runCount on the last hit, for LRU replacement
+};
+
 class PyjionJittedCode {
 public:
     PY_UINT64_T j_runCount;
@@ -153,7 +247,12 @@ public:
     unsigned int j_optimizations;
     Py_EvalFunc j_addr;
     Py_EvalFunc j_genericAddr;
-    uint8_t j_threshold;
+    bool j_genericFailed;
+    Py_EvalFunc j_hooksAddr;// Generic variant with tracing and profiling hooks, for frames started while a hook is set
+    bool j_hooksFailed;
+    uint32_t j_threshold;
+    PY_UINT64_T j_hotness;
+    uint32_t j_backEdges;// Jumps backwards in the code, cold frames only count the ones taken when there are any
     PyObject* j_code;
     PyjionCodeProfile* j_profile;
     unsigned char* j_il;
@@ -167,10 +266,24 @@ public:
     PyObject* j_graph;
     PyObject* j_genericGraph;
     SymbolTable j_symbols;
-    bool j_tracingHooks;
-    bool j_profilingHooks;
+    bool j_tracingHooks;  // The hooks variant calls the trace function
+    bool j_profilingHooks;// The hooks variant calls the profile function
     AbstractValueKind* j_specializedKinds;
     unsigned int j_specializedKindsLen;
+    bool j_compilePending;
+    vector<PyjionSpecialization> j_specializations;
+    unsigned int j_specializationEvictions;
+    bool j_megamorphic;
+    uint32_t j_guardFailures;
+    uint8_t j_reprofiles;
+    bool j_osrEntries;
+    bool j_baseline;
+    uint32_t j_baselineRuns;
+    PyObject* j_donor;// Code object the native code was compiled from when it came out of the compile cache
+    bool j_probesPending;// The probed variant was compiled by pyjion.precompile() and hasn't run yet
+    PyjionCodePolicy j_policy;
+    bool j_policyExplicit;// Set by a decorator, so the module patterns don't apply
+    bool j_policyChecked; // The module patterns have been checked
 
     explicit PyjionJittedCode(PyObject* code) {
         j_compileResult = 0;
@@ -180,7 +293,12 @@ public:
         j_failed = false;
         j_addr = nullptr;
         j_genericAddr = nullptr;
+        j_genericFailed = false;
+        j_hooksAddr = nullptr;
+        j_hooksFailed = false;
         j_threshold = g_pyjionSettings.threshold;
+        j_hotness = 0;
+        j_backEdges = 0;
         j_il = nullptr;
         j_ilLen = 0;
         j_nativeSize = 0;
@@ -196,6 +314,18 @@ public:
         j_profilingHooks = false;
         j_specializedKinds = nullptr;
         j_specializedKindsLen = 0;
+        j_compilePending = false;
+        j_specializationEvictions = 0;
+        j_megamorphic = false;
+        j_guardFailures = 0;
+        j_reprofiles = 0;
+        j_osrEntries = false;
+        j_baseline = false;
+        j_baselineRuns = 0;
+        j_donor = nullptr;
+        j_probesPending = false;
+        j_policyExplicit = false;
+        j_policyChecked = false;
         Py_INCREF(code);
     }
 
@@ -205,6 +335,26 @@ public:
     PyjionJittedCode& operator = (const PyjionJittedCode& code);
 };
 
+// Applies the code object's policy for the duration of a compile or a call. Frames without a policy
+// reset it as well, so code called from a decorated function doesn't pick up its settings.
+class CodePolicyScope {
+    PyjionCodePolicy m_previous;
+    bool m_active;
+
+public:
+    explicit CodePolicyScope(PyjionJittedCode* state) : m_active(state->j_policy.active() || t_compilePolicy.active()) {
+        if (m_active) {
+            m_previous = t_compilePolicy;
+            t_compilePolicy = state->j_policy;
+        }
+    }
+    ~CodePolicyScope() {
+        if (m_active)
+            t_compilePolicy = m_previous;
+    }
+};
+
+OptimizationFlags optimizationsForLevel(unsigned short level);
 void setOptimizationLevel(unsigned short level);
 extern PyObject* PyjionUnboxingError;
 #ifdef WINDOWS
@@ -1,10 +1,20 @@
+import importlib
 import pyjion
 
 
 class PyjionWsgiMiddleware:
-    """Enables the Pyjion JIT for all WSGI requests."""
-    def __init__(self, application):
+    """
+    Enables the Pyjion JIT for all WSGI requests.
+
+    precompile is an optional list of modules (or module names) whose functions
+    are compiled at start-up, so the first requests don't wait for the compiler.
+    """
+    def __init__(self, application, precompile=None):
         pyjion.enable()
+        for module in precompile or ():
+            if isinstance(module, str):
+                module = importlib.import_module(module)
+            pyjion.precompile(module)
         self.application = application
 
     def __call__(self, environ, start_response):